@@ -3,6 +3,53 @@ flox.world_bound = 500.0
 flox.width = 800
 flox.height = 450
 
+-- Headless mode simulates the flock without opening a window. Also available as --headless on the command line.
+flox.headless = false
+flox.headless_frames = 3600
+
+-- Simulation step in seconds for headless and fixed-timestep runs. Also available as --timestep.
+flox.timestep = 1.0 / 60.0
+
+-- Step the windowed simulation in whole timesteps, up to max_substeps per frame, so runs are reproducible.
+-- Also available as --fixed-timestep and --max-substeps.
+flox.fixed_timestep = false
+flox.max_substeps = 4
+
+-- 0 starts the flock in a spiral. Any other seed scatters it, identically on every run. Also available as --seed.
+flox.seed = 0
+
+-- Neighbor kernel: "scalar", "sse4", "avx2" or "avx512". Empty picks the best the CPU supports. Also available as --simd.
+flox.simd = ""
+
+-- Neighbor search: "threaded" builds a quadtree, "grid" bins boids into cells one cohesive radius wide. Also available as --algorithm.
+flox.algorithm = "threaded"
+
+-- Sort the flock into Morton order every this many updates so neighbors sit close in memory. 0 turns it off. Also available as --reorder.
+flox.reorder_interval = 0
+
+-- Search this far past the cohesive radius and reuse each boid's neighbor list until a boid has moved half of it.
+-- 0 searches the quadtree every update. Only the threaded algorithm uses it. Also available as --neighbor-skin.
+flox.neighbor_skin = 0.0
+
+-- Keep the quadtree between updates and move only the boids that left their leaf. Also available as --incremental-tree.
+flox.incremental_tree = false
+
+-- Print p50/p95/p99/max timings for each profiled zone. On by default in debug builds. Also available as --profile.
+--flox.profile = true
+
+-- Count cycles, instructions, cache and branch misses around each flock update. Linux only. Also available as --counters.
+--flox.counters = true
+
+-- Write a Chrome trace-event file of the profiled zones. Open it in chrome://tracing or ui.perfetto.dev.
+--flox.trace_path = "UltimateFlox - Trace.json"
+--flox.trace_start = 120
+--flox.trace_frames = 60
+
+-- Write per-frame timings for every profiled zone as CSV after a warmup, then exit. Also available as --capture.
+--flox.capture_path = "UltimateFlox - Frame Times.csv"
+--flox.capture_warmup = 1200
+--flox.capture_frames = 600
+
 --frame_total = 0.0
 --frame_count = 0
 --total_average = 0.0
@@ -20,6 +67,15 @@ flox.height = 450
 --end
 
 
+-- QuadtreeStatistics() describes the tree built during the last update. Arrays are indexed from depth or fill 0 at 1.
+--function OnFrameStart(delta)
+--    local tree = QuadtreeStatistics()
+--    if tree.longest_chain > 1 then
+--        print("Leaves at max depth overflowed:", tree.chained_leaves, "longest chain:", tree.longest_chain)
+--    end
+--end
+
+
 --function OnExit()
 --    print("Average framerate for program:", 1 / (total_average / total_average_count))
 --end
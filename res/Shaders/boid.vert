@@ -1,14 +1,18 @@
 #version 430 core
 
 layout(location = 0) in vec4 position;
-layout(location = 1) in vec2 offset;
-layout(location = 2) in vec2 velocity;
+layout(location = 1) in float offset_x;
+layout(location = 2) in float offset_y;
+layout(location = 3) in float velocity_x;
+layout(location = 4) in float velocity_y;
 
 uniform mat4 view = mat4(1.0);
 uniform mat4 projection = mat4(1.0);
 uniform float scale = 10.0;
 
 void main() {
+    vec2 offset = vec2(offset_x, offset_y);
+    vec2 velocity = vec2(velocity_x, velocity_y);
     vec2 rotation = velocity / length(velocity);
     mat4 model = mat4(
         scale * rotation.x,  scale * rotation.y, 0.0, 0.0,
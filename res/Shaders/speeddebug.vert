@@ -1,8 +1,10 @@
 #version 430 core
 
 layout(location = 0) in vec4 position;
-layout(location = 1) in vec2 offset;
-layout(location = 2) in vec2 velocity;
+layout(location = 1) in float offset_x;
+layout(location = 2) in float offset_y;
+layout(location = 3) in float velocity_x;
+layout(location = 4) in float velocity_y;
 
 uniform mat4 view = mat4(1.0);
 uniform mat4 projection = mat4(1.0);
@@ -11,6 +13,8 @@ uniform float scale = 10.0;
 layout(location = 0) out float v_VelocityLength;
 
 void main() {
+    vec2 offset = vec2(offset_x, offset_y);
+    vec2 velocity = vec2(velocity_x, velocity_y);
     float velocityLength = length(velocity);
     vec2 rotation = velocity / velocityLength;
     v_VelocityLength = velocityLength;
@@ -1,13 +1,15 @@
 #version 430 core
 
 layout(location = 0) in vec4 position;
-layout(location = 1) in vec2 offset;
+layout(location = 1) in float offset_x;
+layout(location = 2) in float offset_y;
 
 uniform mat4 view = mat4(1.0);
 uniform mat4 projection = mat4(1.0);
 uniform float scale = 10.0;
 
 void main() {
+    vec2 offset = vec2(offset_x, offset_y);
     mat4 model = mat4(
     scale,    0.0,      0.0, 0.0,
     0.0,      scale,    0.0, 0.0,
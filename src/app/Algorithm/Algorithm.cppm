@@ -3,12 +3,18 @@ module;
 export module Algorithm;
 
 import DoubleBuffer;
-import Boid;
+import BoidStore;
 
 
 export class Algorithm {
 public:
     virtual ~Algorithm() = default;
 
-    virtual void update(DoubleBuffer<Boid> &boids, float delta) = 0;
+    virtual void update(DoubleBuffer<BoidStore> &boids, float delta) = 0;
+
+    // Boids were moved between slots outside update, so anything cached per slot is stale.
+    virtual void invalidate() {}
+
+    // Short identifier used by benchmarks and captures.
+    [[nodiscard]] virtual const char *name() const = 0;
 };
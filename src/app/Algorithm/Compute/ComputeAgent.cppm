@@ -0,0 +1,13 @@
+module;
+#include "pch.hpp"
+export module ComputeAgent;
+
+import BoidStore;
+import DoubleBuffer;
+
+
+export class ComputeAgent {
+public:
+    virtual ~ComputeAgent() = default;
+    virtual void update(DoubleBuffer<BoidStore> &boids, float delta) = 0;
+};
@@ -1,5 +1,56 @@
+module;
 #include "pch.hpp"
-#include "DirectComputeAgent.hpp"
+#include <fstream>
+#include <sstream>
+export module DirectComputeAgent;
+
+export import ComputeAgent;
+import Boid;
+import BoidStore;
+import DoubleBuffer;
+import Rectangle;
+
+
+// How do we parallelize bird calculations?
+// We can do multiple compute shaders if needed.
+// Totals have to be accumulated separately because of division but can be added to acceleration in any order.
+// Separation, alignment, and cohesion are the only ones we need to do in parallel. Rest can be done in a for-loop.
+// First, get just one of the behaviors parallelized.
+
+
+export class DirectComputeAgent final : public ComputeAgent {
+    static void delete_buffer(GLuint id);
+    static GLuint get_current_program();
+    static void validate_shader(GLuint id);
+    static void validate_program(GLuint id, GLenum stage);
+    static GLuint compile();
+    static std::string read_file(const char* path);
+
+    void resize_buffers(std::size_t count);
+    void write_uniforms(float delta) const;
+public:
+    explicit DirectComputeAgent(Rectangle bounds);
+    ~DirectComputeAgent() override;
+    void update(DoubleBuffer<BoidStore> &boids, float delta) override;
+private:
+    GLuint m_program_id;
+
+    // Get created on first update.
+    GLuint m_write_buffer_id {0};
+    GLuint m_read_buffer_id {0};
+
+    size_t m_flock_size {0};
+    const Boid *m_write {nullptr};
+    Boid *m_read {nullptr};
+    Rectangle m_bounds;
+
+    GLint u_delta;
+    GLint u_bounds;
+    GLint u_max_speed;
+    GLint u_max_force;
+    GLint u_cohesive_radius;
+    GLint u_disruptive_radius;
+};
 
 
 void DirectComputeAgent::delete_buffer(const GLuint id) {
@@ -22,7 +73,7 @@ void DirectComputeAgent::validate_shader(GLuint id) {
     GLint success = -1;
     glGetShaderiv(id, GL_COMPILE_STATUS, &success);
     if (success == GL_TRUE) { return; }
-    else if (success != GL_FALSE) { unexpected(); }
+    else if (success != GL_FALSE) { throw std::runtime_error("Unexpected shader status."); }
 
     GLint length;
     glGetShaderiv(id, GL_INFO_LOG_LENGTH, &length);
@@ -38,7 +89,7 @@ void DirectComputeAgent::validate_program(const GLuint id, const GLenum stage) {
     GLint success = -1;
     glGetProgramiv(id, stage, &success);
     if (success == GL_TRUE) { return; }
-    else if (success != GL_FALSE) { unexpected(); }
+    else if (success != GL_FALSE) { throw std::runtime_error("Unexpected shader status."); }
 
     GLint length;
     glGetProgramiv(id, GL_INFO_LOG_LENGTH, &length);
@@ -169,19 +220,20 @@ DirectComputeAgent::~DirectComputeAgent() {
     m_read = nullptr;
 }
 
-void DirectComputeAgent::update(DoubleBuffer<Boid> &boids, const float delta) {
+void DirectComputeAgent::update(DoubleBuffer<BoidStore> &boids, const float delta) {
     const size_t count = boids.count();
-    const size_t buffer_size = count * sizeof(Boid);
-    const auto gl_buffer_size = static_cast<GLsizeiptr>(buffer_size);
-    const Boid* read = boids.read();
-    Boid* write = boids.write();
+    const auto gl_buffer_size = static_cast<GLsizeiptr>(count * sizeof(Boid));
+    BoidStore const &read = boids.read();
+    BoidStore &write = boids.write();
 
     if (count > m_flock_size) {
         resize_buffers(count);
     }
 
-    // Copy CPU read buffer into GPU read buffer
-    std::memcpy(m_read, read, buffer_size);
+    // Copy CPU read buffer into GPU read buffer. The shader still takes interleaved boids.
+    for (size_t i = 0; i < count; ++i) {
+        m_read[i] = read.boid(i);
+    }
     glFlushMappedNamedBufferRange(m_read_buffer_id, 0, gl_buffer_size);
     glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
 
@@ -210,7 +262,12 @@ void DirectComputeAgent::update(DoubleBuffer<Boid> &boids, const float delta) {
     const GLenum sync_status {glClientWaitSync(compute_sync, GL_SYNC_FLUSH_COMMANDS_BIT, 8000000)};
     if (sync_status == GL_CONDITION_SATISFIED || sync_status == GL_ALREADY_SIGNALED) {
         // Copy GPU write buffer into CPU write buffer
-        std::memcpy(write, m_write, buffer_size);
+        for (size_t i = 0; i < count; ++i) {
+            write.set(i, m_write[i]);
+        }
+    } else {
+        // The flip swaps buffers, so hold the last state rather than showing the one before it.
+        write.assign(read);
     }
 
     // Restore the previous program.
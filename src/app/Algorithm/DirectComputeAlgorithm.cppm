@@ -0,0 +1,41 @@
+module;
+#include "pch.hpp"
+export module DirectComputeAlgorithm;
+
+export import Algorithm;
+import BoidStore;
+import DirectComputeAgent;
+import DoubleBuffer;
+import Rectangle;
+
+
+// First naive compute algorithm
+// In:
+// . Previous boid position and velocity
+// . Frame delta
+// Out:
+// . New boid position and velocity
+// Should just be array copying.
+// Copy the data out, but we should be able to just swap which point the arrays are bound to.
+// Requires a current OpenGL 4.6 context.
+
+
+export class DirectComputeAlgorithm final : public Algorithm {
+public:
+    explicit DirectComputeAlgorithm(Rectangle bounds);
+    void update(DoubleBuffer<BoidStore> &boids, float dt) override;
+
+    [[nodiscard]] const char *name() const override {
+        return "compute";
+    }
+private:
+    Rectangle m_bounds;
+    DirectComputeAgent m_agent;
+};
+
+
+DirectComputeAlgorithm::DirectComputeAlgorithm(Rectangle bounds) : m_bounds(bounds), m_agent(bounds) {}
+
+void DirectComputeAlgorithm::update(DoubleBuffer<BoidStore> &boids, float dt) {
+    m_agent.update(boids, dt);
+}
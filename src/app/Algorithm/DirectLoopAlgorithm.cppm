@@ -1,17 +1,43 @@
-#include "DirectLoopAlgorithm.hpp"
+module;
+#include "pch.hpp"
+export module DirectLoopAlgorithm;
+
+export import Algorithm;
+import Boid;
+import BoidStore;
+import DoubleBuffer;
+
+
+// Brute force O(n^2) reference. Every boid checks every other boid.
+export class DirectLoopAlgorithm final : public Algorithm {
+public:
+    explicit DirectLoopAlgorithm(Vector bounds);
+
+    ~DirectLoopAlgorithm() override = default;
+
+    void update(DoubleBuffer<BoidStore> &boids, float delta) override;
+
+    [[nodiscard]] const char *name() const override {
+        return "direct";
+    }
+
+private:
+    Vector m_bounds;
+};
+
 
 DirectLoopAlgorithm::DirectLoopAlgorithm(Vector bounds) : m_bounds(bounds) {}
 
-void DirectLoopAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
-    constexpr float disruptiveRadius = Boid::disruptiveRadius * Boid::disruptiveRadius;
-    constexpr float cohesiveRadius = Boid::cohesiveRadius * Boid::cohesiveRadius;
+void DirectLoopAlgorithm::update(DoubleBuffer<BoidStore> &boids, float delta) {
+    const float disruptiveRadius = Boid::disruptiveRadius * Boid::disruptiveRadius;
+    const float cohesiveRadius = Boid::cohesiveRadius * Boid::cohesiveRadius;
 
-    Boid *write = boids.write();
-    Boid const *read = boids.read();
+    BoidStore &write = boids.write();
+    BoidStore const &read = boids.read();
     const size_t count = boids.count();
 
     for (size_t i = 0; i < count; i++) {
-        Boid &currentBoid = write[i];
+        Boid currentBoid = read.boid(i);
 
         Vector centerSteer{0.0f, 0.0f};
         // Precursor to Rectangle class
@@ -21,13 +47,13 @@ void DirectLoopAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
             || currentBoid.position.y + Boid::scale >= m_bounds.y
             ) {
             centerSteer -= currentBoid.position;
-            centerSteer = currentBoid.steer(centerSteer);
+            centerSteer = steer(centerSteer, currentBoid.velocity);
         }
 
         // Desire to move at full speed
         // This is redundant when other forces are acting upon the boid, but that's not always the case.
         Vector fullSpeed = currentBoid.velocity;
-        fullSpeed = currentBoid.steer(fullSpeed);
+        fullSpeed = steer(fullSpeed, currentBoid.velocity);
 
         Vector separation{0.0f, 0.0f};  // Desire to separate from flockmates
         Vector alignment{0.0f, 0.0f};  // Desire to align with the direction of other flockmates
@@ -40,7 +66,7 @@ void DirectLoopAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
                 continue;
             }
 
-            const Boid &otherBoid = read[j];
+            const Boid otherBoid = read.boid(j);
 
             const float d2 = glm::distance2(currentBoid.position, otherBoid.position);
             if (d2 < disruptiveRadius && d2 > 0.0f) {
@@ -58,17 +84,17 @@ void DirectLoopAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
 
         if (disruptiveTotal > 0) {
             separation /= static_cast<float>(disruptiveTotal);
-            separation = currentBoid.steer(separation);
+            separation = steer(separation, currentBoid.velocity);
         }
 
         if (cohesiveTotal > 0) {
             const float countFactor = 1.0f / static_cast<float>(cohesiveTotal);
             alignment *= countFactor;
-            alignment = currentBoid.steer(alignment);
+            alignment = steer(alignment, currentBoid.velocity);
 
             cohesion *= countFactor;
             cohesion -= currentBoid.position;
-            cohesion = currentBoid.steer(cohesion);
+            cohesion = steer(cohesion, currentBoid.velocity);
         }
 
         Vector acceleration{0.0f, 0.0f};
@@ -82,5 +108,6 @@ void DirectLoopAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
 
         currentBoid.velocity += acceleration;
         currentBoid.position += currentBoid.velocity * delta;
+        write.set(i, currentBoid);
     }
 }
@@ -0,0 +1,324 @@
+module;
+#include "pch.hpp"
+export module GridAlgorithm;
+
+export import Algorithm;
+import Boid;
+import BoidStore;
+import DoubleBuffer;
+import HardwareCounters;
+import Profiler;
+import Rectangle;
+import Steering;
+
+const ProfileZone FitGridZone {"GridAlgorithm::fit_grid"};
+const ProfileZone CountCellsZone {"GridAlgorithm::count_cells"};
+const ProfileZone PrefixSumZone {"GridAlgorithm::prefix_sum"};
+const ProfileZone ScatterZone {"GridAlgorithm::scatter"};
+const ProfileZone SteerZone {"GridAlgorithm::steer"};
+const ProfileZone GridWaitZone {"GridAlgorithm::wait"};
+
+
+// Uniform grid over the flock with cells at least Boid::cohesiveRadius wide, so every neighbor of a boid is in the
+//   3x3 block of cells around its own.
+// Rebuilt every update by a counting sort. Each slice of boids counts its cells, a prefix sum over blocks of cells
+//   turns the counts into offsets, then each slice scatters its indices into cell order. Slices keep their order inside a cell,
+//   so the result is the same for any thread count.
+// Cells are numbered row by row, so each row of a 3x3 block is one contiguous run of sorted indices.
+export class GridAlgorithm final : public Algorithm {
+public:
+    static constexpr int DefaultThreadCount = 8;
+
+    explicit GridAlgorithm(Vector bounds, int thread_count = DefaultThreadCount);
+
+    ~GridAlgorithm() override {
+        m_pool.shutdown();
+    }
+
+    void update(DoubleBuffer<BoidStore> &boids, float delta) override;
+
+    [[nodiscard]] const char *name() const override {
+        return "grid";
+    }
+
+    [[nodiscard]] int thread_count() const {
+        return m_thread_count;
+    }
+
+    // Shape of the grid built by the last update.
+    [[nodiscard]] size_t columns() const {
+        return m_columns;
+    }
+
+    [[nodiscard]] size_t rows() const {
+        return m_rows;
+    }
+
+    [[nodiscard]] float cell_size() const {
+        return m_cell_size;
+    }
+
+private:
+    // Runs work(slice) for every slice, the last one on the calling thread, and waits for the rest.
+    template<typename Work>
+    void for_each_slice(Work const &work);
+
+    // First boid of a slice. Slices start on a SteeringBlock boundary so blocks never straddle two threads.
+    [[nodiscard]] size_t slice_start(int slice, size_t count) const;
+
+    void fit_grid(BoidStore const &read, size_t count);
+    void count_cells(BoidStore const &read, int slice, size_t count);
+    void prefix_sum(size_t count);
+    void scatter(int slice, size_t count);
+    void steer(BoidStore const &read, BoidStore &write, int slice, size_t count, float delta);
+
+    Rectangle m_bounds;
+
+    int m_thread_count;
+    ThreadPool m_pool;
+    std::vector<std::future<void>> m_futures;
+
+    // Grid placement. Cell (column, row) covers origin + cell_size * [column, column + 1) x [row, row + 1).
+    Vector m_origin {0.0f};
+    float m_cell_size = 0.0f;
+    size_t m_columns = 0;
+    size_t m_rows = 0;
+
+    std::vector<uint32_t> m_cells;         // Cell of each boid.
+    std::vector<uint32_t> m_slice_counts;  // Boids per cell per slice, slice-major. Offsets after prefix_sum.
+    std::vector<uint32_t> m_block_starts;  // First sorted index of each prefix_sum block of cells.
+    std::vector<uint32_t> m_cell_starts;   // First sorted index of each cell, plus one past the end.
+    std::vector<uint32_t> m_sorted;        // Boid indices in cell order.
+    std::vector<Vector> m_slice_min, m_slice_max;
+    std::vector<std::vector<uint32_t>> m_results;
+};
+
+
+GridAlgorithm::GridAlgorithm(Vector bounds, const int thread_count) :
+    m_bounds(bounds),
+    m_thread_count(std::max(thread_count, 1)),
+    m_pool(m_thread_count - 1),
+    m_futures(m_thread_count - 1),
+    m_slice_min(m_thread_count),
+    m_slice_max(m_thread_count),
+    m_block_starts(m_thread_count),
+    m_results(m_thread_count)
+{
+    for (auto &results: m_results) {
+        results.reserve(128);
+    }
+
+    m_pool.init();
+}
+
+template<typename Work>
+void GridAlgorithm::for_each_slice(Work const &work) {
+    for (int slice = 0; slice < m_thread_count - 1; ++slice) {
+        m_futures[slice] = m_pool.submit([&work, slice]() {
+            CounterScope counters;  // Pool threads. Work done on the calling thread is already counted around update.
+            work(slice);
+        });
+    }
+
+    work(m_thread_count - 1);
+
+    for (auto &future: m_futures) {
+        if (future.valid()) {
+            ProfileScope wait {GridWaitZone};
+            future.get();
+        }
+    }
+}
+
+size_t GridAlgorithm::slice_start(const int slice, const size_t count) const {
+    const size_t blocks = (count + SteeringBlock::Capacity - 1) / SteeringBlock::Capacity;
+    const size_t start = blocks * slice / m_thread_count * SteeringBlock::Capacity;
+    return std::min(start, count);
+}
+
+void GridAlgorithm::update(DoubleBuffer<BoidStore> &boids, const float delta) {
+    const size_t count = boids.count();
+    if (count == 0) { return; }
+
+    BoidStore const &read = boids.read();
+    BoidStore &write = boids.write();
+
+    m_cells.resize(count);
+    m_sorted.resize(count);
+
+    fit_grid(read, count);
+
+    {
+        ProfileScope profile {CountCellsZone};
+        for_each_slice([&](const int slice) { count_cells(read, slice, count); });
+    }
+
+    prefix_sum(count);
+
+    {
+        ProfileScope profile {ScatterZone};
+        for_each_slice([&](const int slice) { scatter(slice, count); });
+    }
+
+    ProfileScope profile {SteerZone};
+    for_each_slice([&](const int slice) { steer(read, write, slice, count, delta); });
+}
+
+void GridAlgorithm::fit_grid(BoidStore const &read, const size_t count) {
+    ProfileScope profile {FitGridZone};
+    for_each_slice([&](const int slice) {
+        const size_t end = slice_start(slice + 1, count);
+        Vector low {std::numeric_limits<float>::max()};
+        Vector high {std::numeric_limits<float>::lowest()};
+        for (size_t i = slice_start(slice, count); i < end; ++i) {
+            low = glm::min(low, read.position(i));
+            high = glm::max(high, read.position(i));
+        }
+
+        m_slice_min[slice] = low;
+        m_slice_max[slice] = high;
+    });
+
+    Vector low {std::numeric_limits<float>::max()};
+    Vector high {std::numeric_limits<float>::lowest()};
+    for (int slice = 0; slice < m_thread_count; ++slice) {
+        low = glm::min(low, m_slice_min[slice]);
+        high = glm::max(high, m_slice_max[slice]);
+    }
+
+    // A scattered flock would need a huge grid of mostly empty cells. Widen the cells instead so there are never
+    //   more cells than boids; the 3x3 search stays correct, it only reads more candidates.
+    const Vector extent = high - low;
+    const auto max_cells = static_cast<float>(std::max<size_t>(count, 1));
+    float cell_size = Boid::cohesiveRadius;
+    while ((extent.x / cell_size + 1.0f) * (extent.y / cell_size + 1.0f) > max_cells) {
+        cell_size *= 1.5f;
+    }
+
+    m_origin = low;
+    m_cell_size = cell_size;
+    m_columns = static_cast<size_t>(extent.x / cell_size) + 1;
+    m_rows = static_cast<size_t>(extent.y / cell_size) + 1;
+    // Each slice clears its own counts in count_cells.
+    m_slice_counts.resize(m_columns * m_rows * m_thread_count);
+}
+
+void GridAlgorithm::count_cells(BoidStore const &read, const int slice, const size_t count) {
+    const float inverse_size = 1.0f / m_cell_size;
+    const size_t cells = m_columns * m_rows;
+    uint32_t *counts = m_slice_counts.data() + slice * cells;
+    std::fill_n(counts, cells, 0);
+    float const *x = read.x();
+    float const *y = read.y();
+
+    const size_t end = slice_start(slice + 1, count);
+    for (size_t i = slice_start(slice, count); i < end; ++i) {
+        // Clamped in case rounding puts the farthest boid one cell past the edge.
+        const size_t column = std::min(static_cast<size_t>((x[i] - m_origin.x) * inverse_size), m_columns - 1);
+        const size_t row = std::min(static_cast<size_t>((y[i] - m_origin.y) * inverse_size), m_rows - 1);
+        const auto cell = static_cast<uint32_t>(row * m_columns + column);
+        m_cells[i] = cell;
+        ++counts[cell];
+    }
+}
+
+// Two passes over blocks of cells, one block per thread: total each block, then scan each block from its start.
+// Each pass reads every slice's counts for the block front to back.
+void GridAlgorithm::prefix_sum(const size_t count) {
+    ProfileScope profile {PrefixSumZone};
+    const size_t cells = m_columns * m_rows;
+    m_cell_starts.resize(cells + 1);
+    const auto block_start = [&](const int block) {
+        return cells * block / m_thread_count;
+    };
+
+    for_each_slice([&](const int block) {
+        const size_t end = block_start(block + 1);
+        uint32_t boids = 0;
+        for (int slice = 0; slice < m_thread_count; ++slice) {
+            uint32_t const *counts = m_slice_counts.data() + slice * cells;
+            for (size_t cell = block_start(block); cell < end; ++cell) {
+                boids += counts[cell];
+            }
+        }
+        m_block_starts[block] = boids;
+    });
+
+    uint32_t total = 0;
+    for (uint32_t &start: m_block_starts) {
+        const uint32_t boids = start;
+        start = total;
+        total += boids;
+    }
+
+    // Counts become the offset each slice starts writing a cell at: cell by cell, slice by slice within a cell.
+    for_each_slice([&](const int block) {
+        const size_t end = block_start(block + 1);
+        uint32_t offset = m_block_starts[block];
+        for (size_t cell = block_start(block); cell < end; ++cell) {
+            m_cell_starts[cell] = offset;
+            for (int slice = 0; slice < m_thread_count; ++slice) {
+                uint32_t &slot = m_slice_counts[slice * cells + cell];
+                const uint32_t boids = slot;
+                slot = offset;
+                offset += boids;
+            }
+        }
+    });
+
+    m_cell_starts[cells] = static_cast<uint32_t>(count);
+}
+
+void GridAlgorithm::scatter(const int slice, const size_t count) {
+    uint32_t *offsets = m_slice_counts.data() + slice * m_columns * m_rows;
+    const size_t end = slice_start(slice + 1, count);
+    for (size_t i = slice_start(slice, count); i < end; ++i) {
+        m_sorted[offsets[m_cells[i]]++] = static_cast<uint32_t>(i);
+    }
+}
+
+void GridAlgorithm::steer(
+    BoidStore const &read, BoidStore &write, const int slice, const size_t count, const float delta
+) {
+    auto &results = m_results[slice];
+    const float disruptive_radius = Boid::disruptiveRadius * Boid::disruptiveRadius;
+    const float cohesive_radius = Boid::cohesiveRadius * Boid::cohesiveRadius;
+
+    const Rectangle center_bound {m_bounds * 0.75f};
+    const Rectangle hard_bound {m_bounds * 0.90f};
+
+    SteeringBlock block;
+    const size_t end = slice_start(slice + 1, count);
+    for (size_t first = slice_start(slice, count); first < end; first += SteeringBlock::Capacity) {
+        const size_t block_count = std::min(SteeringBlock::Capacity, end - first);
+        for (size_t lane = 0; lane < block_count; ++lane) {
+            const auto self = static_cast<uint32_t>(first + lane);
+            const size_t cell = m_cells[self];
+            const size_t column = cell % m_columns;
+            const size_t row = cell / m_columns;
+
+            // Each row of the 3x3 block is one run of the sorted indices.
+            const size_t first_column = column > 0 ? column - 1 : 0;
+            const size_t last_column = std::min(column + 1, m_columns - 1);
+            const size_t first_row = row > 0 ? row - 1 : 0;
+            const size_t last_row = std::min(row + 1, m_rows - 1);
+
+            results.clear();
+            for (size_t r = first_row; r <= last_row; ++r) {
+                const uint32_t run_start = m_cell_starts[r * m_columns + first_column];
+                const uint32_t run_end = m_cell_starts[r * m_columns + last_column + 1];
+                for (uint32_t s = run_start; s < run_end; ++s) {
+                    if (m_sorted[s] != self) {
+                        results.push_back(m_sorted[s]);
+                    }
+                }
+            }
+
+            block.set(lane, accumulate_neighbors(
+                read.position(self), read, results, disruptive_radius, cohesive_radius
+            ));
+        }
+
+        steer_block(block, block_count, read, write, first, center_bound, hard_bound, delta);
+    }
+}
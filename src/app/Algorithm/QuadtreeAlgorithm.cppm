@@ -1,16 +1,46 @@
-#include "QuadtreeAlgorithm.hpp"
-#include "Structures/RawArray.hpp"
+module;
+#include "pch.hpp"
+export module QuadtreeAlgorithm;
 
-QuadtreeAlgorithm::QuadtreeAlgorithm(Vector b) : m_bounds(b), m_treeBounds(m_bounds), m_tree(m_treeBounds) {
-    m_results.reserve(128);
-}
+export import Algorithm;
+import Boid;
+import BoidStore;
+import Boidtree;
+import DoubleBuffer;
+import RawArray;
+import Rectangle;
+
+
+// Single-threaded version of ThreadedAlgorithm. Expose tree for rendering
+export class QuadtreeAlgorithm final : public Algorithm {
+public:
+    explicit QuadtreeAlgorithm(Vector bounds);
+
+    ~QuadtreeAlgorithm() override = default;
+
+    void update(DoubleBuffer<BoidStore> &boids, float delta) override;
+
+    [[nodiscard]] const char *name() const override {
+        return "quadtree";
+    }
 
-void QuadtreeAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
+    [[nodiscard]] Boidtree const &tree() const;
+
+protected:
+    Rectangle m_bounds;
+    Rectangle m_treeBounds;
+    Boidtree m_tree;
+};
+
+
+QuadtreeAlgorithm::QuadtreeAlgorithm(Vector b) : m_bounds(b), m_treeBounds(m_bounds), m_tree(m_treeBounds) {}
+
+void QuadtreeAlgorithm::update(DoubleBuffer<BoidStore> &boids, float delta) {
     const float disruptiveRadius = Boid::disruptiveRadius * Boid::disruptiveRadius;
     const float cohesiveRadius = Boid::cohesiveRadius * Boid::cohesiveRadius;
 
-    Boid *write = boids.write();
-    Boid const *read = boids.read();
+    BoidStore &write = boids.write();
+    BoidStore const &read = boids.read();
     const auto count = static_cast<ptrdiff_t>(boids.count());
 
     m_tree.clear();
@@ -18,25 +48,20 @@ void QuadtreeAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
     Vector xBound {m_treeBounds.center.x - m_treeBounds.size.x, m_treeBounds.center.x + m_treeBounds.size.x};
     Vector yBound {m_treeBounds.center.y - m_treeBounds.size.y, m_treeBounds.center.y + m_treeBounds.size.y};
 
-    //for (ptrdiff_t i = 0; i < count; ++i) {
-    for (Boid const& boid : RawArray(read, count)) {
-        //m_tree.insert(boid, boid.position);
-        m_tree.insert(&boid, boid.position);
-        //m_tree.insert(i, read[i].position);
+    for (ptrdiff_t i = 0; i < count; ++i) {
+        m_tree.insert(static_cast<uint32_t>(i), read.position(i));
     }
 
     Rectangle centerBound{m_bounds * 0.75f};
     Rectangle hardBound{m_bounds * 2.0f};
 
     Rectangle boidBound{Vector{Boid::scale}};
-    Rectangle searchBound{Vector{Boid::cohesiveRadius}};
-    //for (Boid &current : RawArray(write, count)) {
+    Circle searchArea{Vector{0.0f}, Boid::cohesiveRadius};
     for(int i = 0; i < count; ++i) {
-        Boid &current = write[i];
-        const Boid &previous = read[i];
+        Boid current = read.boid(i);
 
         boidBound.center = current.position;
-        searchBound.center = current.position;
+        searchArea.center = current.position;
         Vector centerSteer{0.0f, 0.0f};
 
         const bool inCenter = centerBound.intersects(boidBound);
@@ -47,11 +72,11 @@ void QuadtreeAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
             }
 
             centerSteer -= current.position;
-            centerSteer = steer(current.velocity, centerSteer);
+            centerSteer = steer(centerSteer, current.velocity);
         }
 
         Vector fullSpeed = current.velocity;
-        fullSpeed = steer(current.velocity, fullSpeed);
+        fullSpeed = steer(fullSpeed, current.velocity);
 
         Vector separation{0.0f, 0.0f};
         Vector alignment{0.0f, 0.0f};
@@ -59,45 +84,37 @@ void QuadtreeAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
         size_t cohesiveTotal = 0;
         size_t disruptiveTotal = 0;
 
-        m_results.clear();
-        //m_tree.search(searchBound, m_results);
-        search(m_tree, &previous, searchBound, m_results);
-        //for(const auto j: m_results) {
-        for (Boid const &other : m_results) {
-            //if (current.position == other.position) {
-            //if (i == j) {
-            //    continue;
-            //}
-
-            //const Boid& other = read[j];
-            const float d2 = glm::distance2(current.position, other.position);
+        // Fused with the search: neighbors are summed as the leaves are walked, without a results vector.
+        // The search only returns cohesive neighbors, and measures their distance on the way.
+        for_each_neighbor(m_tree, static_cast<uint32_t>(i), searchArea, [&](const uint32_t j, const float d2) {
+            const Vector other = read.position(j);
             if (d2 < disruptiveRadius && d2 > 0.0f) {
-                Vector diff = current.position - other.position;
+                Vector diff = current.position - other;
                 separation += diff / d2;
                 disruptiveTotal++;
             }
 
             if (d2 < cohesiveRadius) {
-                alignment += other.velocity;
-                cohesion += other.position;
+                alignment += read.velocity(j);
+                cohesion += other;
                 cohesiveTotal++;
             }
-        }
+        });
 
         if (disruptiveTotal > 0) {
             separation /= static_cast<float>(disruptiveTotal);
             //separation = current.steer(separation);
-            separation = steer(current.velocity, separation);
+            separation = steer(separation, current.velocity);
         }
 
         if (cohesiveTotal > 0) {
             const float countFactor = 1.0f / static_cast<float>(cohesiveTotal);
             alignment *= countFactor;
-            alignment = steer(current.velocity, alignment);
+            alignment = steer(alignment, current.velocity);
 
             cohesion *= countFactor;
             cohesion -= current.position;
-            cohesion = steer(current.velocity, cohesion);
+            cohesion = steer(cohesion, current.velocity);
         }
 
         Vector acceleration{0.0f, 0.0f};
@@ -111,20 +128,23 @@ void QuadtreeAlgorithm::update(DoubleBuffer<Boid> &boids, float delta) {
 
         current.velocity += acceleration;
         current.position += current.velocity * delta;
+        write.set(i, current);
     }
 
     // Separate loop. Does this slow the program down?
-    for (auto const& current: RawArray(write, count)) {
-        if (current.position.x < xBound.r) {
-            xBound.r = current.position.x;
-        } else if (current.position.x > xBound.g) {
-            xBound.g = current.position.x;
+    for (const float x: RawArray(write.x(), count)) {
+        if (x < xBound.r) {
+            xBound.r = x;
+        } else if (x > xBound.g) {
+            xBound.g = x;
         }
+    }
 
-        if (current.position.y < yBound.r) {
-            yBound.r = current.position.y;
-        } else if (current.position.y > yBound.g) {
-            yBound.g = current.position.y;
+    for (const float y: RawArray(write.y(), count)) {
+        if (y < yBound.r) {
+            yBound.r = y;
+        } else if (y > yBound.g) {
+            yBound.g = y;
         }
     }
 
@@ -1,16 +1,32 @@
 module;
 #include "pch.hpp"
+#include <span>
 export module ThreadedAlgorithm;
 
 export import Algorithm;
 import Boid;
+import BoidStore;
 import Boidtree;
 import DoubleBuffer;
+import HardwareCounters;
+import Profiler;
+import Quadtree;
 import RawArray;
 import Rectangle;
+import Steering;
 
 constexpr ptrdiff_t BOID_GROUP = 8;
 
+const ProfileZone PopulateTreeZone {"ThreadedAlgorithm::populate_tree"};
+const ProfileZone FreezeTreeZone {"ThreadedAlgorithm::freeze_tree"};
+const ProfileZone BulkLoadZone {"ThreadedAlgorithm::bulk_load"};
+const ProfileZone ValidateTreeZone {"ThreadedAlgorithm::validate_tree"};
+const ProfileZone CheckListsZone {"ThreadedAlgorithm::check_lists"};
+const ProfileZone DistributeWorkZone {"ThreadedAlgorithm::distribute_work"};
+const ProfileZone RecalculateBoundsZone {"ThreadedAlgorithm::recalculate_bounds"};
+const ProfileZone WaitZone {"ThreadedAlgorithm::wait"};
+const ProfileZone ThreadWorkZone {"ThreadWork"};
+
 
 export class ThreadedAlgorithm;
 
@@ -19,12 +35,12 @@ struct ThreadWork {
     ThreadedAlgorithm *algorithm;
     int id;
     float delta;
-    const Boid *read;
-    Boid *write;
+    BoidStore const *read;
+    BoidStore *write;
     ptrdiff_t count;
     ptrdiff_t start;
 
-    ThreadWork(ThreadedAlgorithm *a, int i, float d, const Boid *r, Boid *w, ptrdiff_t c, ptrdiff_t s) :
+    ThreadWork(ThreadedAlgorithm *a, int i, float d, BoidStore const *r, BoidStore *w, ptrdiff_t c, ptrdiff_t s) :
         algorithm(a), id(i), delta(d), read(r), write(w), count(c), start(s) {}
 
     void operator()() const;
@@ -32,15 +48,110 @@ struct ThreadWork {
 
 
 export class ThreadedAlgorithm final : public Algorithm {
-    void populate_tree(const Boid *read, const ptrdiff_t count) {
+    void populate_tree(BoidStore const &read, const ptrdiff_t count) {
+        ProfileScope profile {PopulateTreeZone};
+        float const *x = read.x();
+        float const *y = read.y();
+
+        // Move the boids that changed leaves instead of starting over, as long as the tree still holds the same
+        //   slots under the same bounds.
+        const bool same_bounds = m_tree.bounds.center == m_treeBounds.center && m_tree.bounds.size == m_treeBounds.size;
+        if (m_incremental_tree && m_tree_count == count && same_bounds) {
+            if (m_tree.relocate([x, y](const uint32_t i) { return Vector {x[i], y[i]}; })) {
+                return;
+            }
+        }
+
         m_tree.clear();
         m_tree.bounds = m_treeBounds;
-        for (Boid const &boid: RawArray(read, count)) {
-            m_tree.insert(&boid, boid.position);
+        for (ptrdiff_t i = 0; i < count; ++i) {
+            m_tree.insert(static_cast<uint32_t>(i), Vector {x[i], y[i]});
+        }
+
+        m_tree_count = count;
+    }
+
+    void freeze_tree() {
+        ProfileScope profile {FreezeTreeZone};
+        m_frozen.freeze(m_tree);
+    }
+
+    // Builds the search tree straight from the flock on every thread. Same tree as populate_tree and freeze_tree.
+    void bulk_load_tree(BoidStore const &read, const ptrdiff_t count) {
+        ProfileScope profile {BulkLoadZone};
+        float const *x = read.x();
+        float const *y = read.y();
+        m_frozen.bulk_load(
+            m_treeBounds, static_cast<size_t>(count), [x, y](const size_t i) { return Vector {x[i], y[i]}; },
+            m_thread_count, [this](auto const &work) { for_each_slice(work); }
+        );
+
+        m_tree_count = 0;  // The linked tree was not touched.
+    }
+
+    // Debug builds check the trees after every build, before the unchecked searches of a release build would trust them.
+    void validate_tree() const {
+        ProfileScope profile {ValidateTreeZone};
+        if (m_incremental_tree) {
+            m_tree.validate();
         }
+
+        m_frozen.validate();
     }
 
-    void distribute_work(const Boid *read, Boid *write, const ptrdiff_t count, const float delta) {
+    // Runs work(slice) for every thread, the last slice on the calling thread, and waits for the rest.
+    template<typename Work>
+    void for_each_slice(Work const &work) {
+        for (int slice = 0; slice < m_thread_count - 1; ++slice) {
+            m_futures[slice] = m_pool.submit([&work, slice]() {
+                CounterScope counters;
+                work(slice);
+            });
+        }
+
+        work(m_thread_count - 1);
+
+        for (auto &future: m_futures) {
+            if (future.valid()) {
+                ProfileScope wait {WaitZone};
+                future.get();
+            }
+        }
+    }
+
+    // Neighbor lists stay usable until some boid has moved more than half the skin since they were built.
+    // Two boids each moving that far can close at most one whole skin, so every pair now within the cohesive radius
+    //   was within the cohesive radius plus the skin when the lists were searched.
+    [[nodiscard]] bool lists_valid(BoidStore const &read, const ptrdiff_t count) const {
+        ProfileScope profile {CheckListsZone};
+        if (!m_lists_valid || m_list_count != count) {
+            return false;
+        }
+
+        const float limit = 0.25f * m_skin * m_skin;
+        float const *x = read.x();
+        float const *y = read.y();
+        float farthest = 0.0f;
+        for (ptrdiff_t i = 0; i < count; ++i) {
+            const float dx = x[i] - m_list_x[i];
+            const float dy = y[i] - m_list_y[i];
+            farthest = std::max(farthest, dx * dx + dy * dy);
+        }
+
+        return farthest <= limit;
+    }
+
+    // Positions the next lists are searched from.
+    void record_list_positions(BoidStore const &read, const ptrdiff_t count) {
+        m_list_x.assign(read.x(), read.x() + count);
+        m_list_y.assign(read.y(), read.y() + count);
+        m_list_begin.resize(count);
+        m_list_end.resize(count);
+        m_list_count = count;
+    }
+
+    void distribute_work(BoidStore const &read, BoidStore &write, const ptrdiff_t count, const float delta) {
+        ProfileScope profile {DistributeWorkZone};
         // Maybe compute these values only when flock size changes?
         // Compiler should see div/mod and combine operations.
         // Number of groups of boids.
@@ -50,10 +161,10 @@ export class ThreadedAlgorithm final : public Algorithm {
         const ptrdiff_t leftover_boids = count % BOID_GROUP;
 
         // Number of boid groups per thread. 0 if less than ThreadCount groups.
-        const ptrdiff_t boid_groups_per_thread = boid_groups / ThreadCount;
+        const ptrdiff_t boid_groups_per_thread = boid_groups / m_thread_count;
 
         // Number of groups not evenly distributed across the threads. Evenly distribute them across the threads.
-        ptrdiff_t leftover_groups = boid_groups % ThreadCount;
+        ptrdiff_t leftover_groups = boid_groups % m_thread_count;
         const ptrdiff_t boids_per_thread = BOID_GROUP * boid_groups_per_thread;
 
         //std::cout << '\n'
@@ -71,8 +182,8 @@ export class ThreadedAlgorithm final : public Algorithm {
         // See if we need to take a group here.
         const ptrdiff_t final_start {
             primary_thread_needs_work ?
-            BOID_GROUP * (boid_groups_per_thread * (ThreadCount - 1) + leftover_groups - (leftover_groups > 0)) :
-            BOID_GROUP * (boid_groups_per_thread * (ThreadCount - 1) + leftover_groups)
+            BOID_GROUP * (boid_groups_per_thread * (m_thread_count - 1) + leftover_groups - (leftover_groups > 0)) :
+            BOID_GROUP * (boid_groups_per_thread * (m_thread_count - 1) + leftover_groups)
         };
 
         // Take the group here.
@@ -82,16 +193,15 @@ export class ThreadedAlgorithm final : public Algorithm {
             boids_per_thread + leftover_boids
         };
 
-        ThreadFutures futures {};
         if (boid_groups_per_thread > 0 || leftover_groups > 0) {
             ptrdiff_t next_start = 0;
-            for (int i = 0; i < ThreadCount - 1; ++i) {
+            for (int i = 0; i < m_thread_count - 1; ++i) {
                 if (boid_groups_per_thread == 0 && leftover_groups <= 0) { break; }
-                futures[i] = m_pool.submit(
+                m_futures[i] = m_pool.submit(
                     [](ThreadWork thread_work) { thread_work(); },
                     ThreadWork {
                         this, i, delta,
-                        read, write,
+                        &read, &write,
                         boids_per_thread + (leftover_groups > 0) * BOID_GROUP,  // I might take a group below.
                         next_start
                     }
@@ -102,32 +212,37 @@ export class ThreadedAlgorithm final : public Algorithm {
         }
 
         //Do my work.
-        ThreadWork {this, ThreadCount - 1, delta, read, write, final_count, final_start}();
+        ThreadWork {this, m_thread_count - 1, delta, &read, &write, final_count, final_start}();
 
         // Wait for the others to finish their work.
-        for (auto &update_future: futures) {
+        for (auto &update_future: m_futures) {
             if (update_future.valid()) {
+                ProfileScope wait {WaitZone};
                 update_future.get();
             }
         }
     }
 
-    void recalculate_bounds(Boid *write, const ptrdiff_t count) {
+    void recalculate_bounds(BoidStore const &write, const ptrdiff_t count) {
+        ProfileScope profile {RecalculateBoundsZone};
         // Separate loop for thread-safety. Does this slow the program down?
         // Maybe have an array where the results of this test from each thread are stored and join them after.
         Vector x_bound {m_treeBounds.center.x - m_treeBounds.size.x, m_treeBounds.center.x + m_treeBounds.size.x};
         Vector y_bound {m_treeBounds.center.y - m_treeBounds.size.y, m_treeBounds.center.y + m_treeBounds.size.y};
-        for (auto const &current: RawArray(write, count)) {
-            if (current.position.x < x_bound.r) {
-                x_bound.r = current.position.x;
-            } else if (current.position.x > x_bound.g) {
-                x_bound.g = current.position.x;
+        // Only the position arrays are read.
+        for (const float x: RawArray(write.x(), count)) {
+            if (x < x_bound.r) {
+                x_bound.r = x;
+            } else if (x > x_bound.g) {
+                x_bound.g = x;
             }
+        }
 
-            if (current.position.y < y_bound.r) {
-                y_bound.r = current.position.y;
-            } else if (current.position.y > y_bound.g) {
-                y_bound.g = current.position.y;
+        for (const float y: RawArray(write.y(), count)) {
+            if (y < y_bound.r) {
+                y_bound.r = y;
+            } else if (y > y_bound.g) {
+                y_bound.g = y;
             }
         }
 
@@ -145,11 +260,26 @@ export class ThreadedAlgorithm final : public Algorithm {
     friend ThreadWork;
 
 public:
-    explicit ThreadedAlgorithm(Vector b) : m_bounds(b), m_treeBounds(m_bounds), m_tree(m_treeBounds) {
+    static constexpr int DefaultThreadCount = 8;
+
+    explicit ThreadedAlgorithm(Vector b, const int thread_count = DefaultThreadCount) :
+        m_bounds(b), m_treeBounds(m_bounds), m_tree(m_treeBounds),
+        m_thread_count(std::max(thread_count, 1)),
+        m_pool(m_thread_count - 1),
+        m_futures(m_thread_count - 1),
+        m_results(m_thread_count),
+        m_distances(m_thread_count),
+        m_lists(m_thread_count),
+        m_search_counters(m_thread_count)
+    {
         for (auto &m_result: m_results) {
             m_result.reserve(128);
         }
 
+        for (auto &distances: m_distances) {
+            distances.reserve(128);
+        }
+
         m_pool.init();
     }
 
@@ -157,139 +287,216 @@ public:
         m_pool.shutdown();
     }
 
-    void update(DoubleBuffer<Boid> &boids, const float delta) override {
+    void update(DoubleBuffer<BoidStore> &boids, const float delta) override {
         const auto count = static_cast<ptrdiff_t>(boids.count());
         if (count == 0) { return; }
 
-        const Boid *read = boids.read();
-        Boid *write = boids.write();
+        BoidStore const &read = boids.read();
+        BoidStore &write = boids.write();
+
+        if (m_count_searches) {
+            std::fill(m_search_counters.begin(), m_search_counters.end(), SearchCounters {});
+        }
+
+        // With neighbor lists, the tree is only rebuilt and searched when the lists have gone stale.
+        m_rebuild_lists = m_skin > 0.0f && !lists_valid(read, count);
+        if (m_skin <= 0.0f || m_rebuild_lists) {
+            if (m_incremental_tree) {
+                // Update the boids in the quadtree, then harden it for the searches.
+                populate_tree(read, count);
+                freeze_tree();
+            } else {
+                bulk_load_tree(read, count);
+            }
+
+            if constexpr (QuadtreeAccess::Checked) {
+                validate_tree();
+            }
+        }
 
-        // Insert the boids into the quadtree
-        populate_tree(boids.read(), count);
+        if (m_rebuild_lists) {
+            record_list_positions(read, count);
+        }
 
         // Distribute the calculation work evenly among the available threads.
         distribute_work(read, write, count, delta);
 
         // Recalculate the bounds of the quadtree to keep the birds inside.
-        recalculate_bounds(boids.write(), count);
+        recalculate_bounds(write, count);
+        m_lists_valid = m_skin > 0.0f;
+    }
+
+    void invalidate() override {
+        m_lists_valid = false;
+        m_tree_count = 0;
+    }
+
+    [[nodiscard]] const char *name() const override {
+        return "threaded";
+    }
+
+    // The tree searched by the last update.
+    [[nodiscard]] FrozenBoidtree const &tree() const {
+        return m_frozen;
+    }
+
+    [[nodiscard]] int thread_count() const {
+        return m_thread_count;
+    }
+
+    // Gather SearchCounters for each ThreadWork during the following updates.
+    void count_searches(const bool value) {
+        m_count_searches = value;
+    }
+
+    [[nodiscard]] bool counting_searches() const {
+        return m_count_searches;
+    }
+
+    // Search each boid's neighbors within the cohesive radius plus skin, keep them as a list, and reuse the list
+    //   until some boid has moved more than half the skin. 0 searches the tree every update.
+    void neighbor_skin(const float skin) {
+        m_skin = std::max(skin, 0.0f);
+        m_lists_valid = false;
     }
 
-    [[nodiscard]] Boidtree const &tree() const {
-        return m_tree;
+    [[nodiscard]] float neighbor_skin() const {
+        return m_skin;
+    }
+
+    // Keep the quadtree between updates and only move the boids that left their leaf, instead of rebuilding it.
+    // The tree is still rebuilt whenever its bounds grow or the flock changes size or order.
+    void incremental_tree(const bool value) {
+        m_incremental_tree = value;
+    }
+
+    [[nodiscard]] bool incremental_tree() const {
+        return m_incremental_tree;
+    }
+
+    // Counters from the last update, one per ThreadWork slice.
+    [[nodiscard]] std::vector<SearchCounters> const &search_counters() const {
+        return m_search_counters;
     }
 private:
-    static constexpr int ThreadCount = 8;
-    using ThreadFutures = std::array<std::future<void>, ThreadCount - 1>;
-    using QuadtreeResults = std::vector<Boid>;
+    using ThreadFutures = std::vector<std::future<void>>;
+    using QuadtreeResults = std::vector<uint32_t>;  // Indices into the read store.
 
     Rectangle m_bounds;
     Rectangle m_treeBounds;
-    Boidtree m_tree;
+    Boidtree m_tree;          // Only kept up to date with incremental_tree.
+    FrozenBoidtree m_frozen;  // What ThreadWork searches.
+    bool m_incremental_tree = false;
+    ptrdiff_t m_tree_count = 0;  // Boids in m_tree. 0 when its slots are stale.
     //std::mutex m_mutex;
 
-    ThreadPool m_pool {ThreadCount - 1};
-    QuadtreeResults m_results[ThreadCount];
+    int m_thread_count;
+    ThreadPool m_pool;
+    ThreadFutures m_futures;
+    std::vector<QuadtreeResults> m_results;
+    std::vector<std::vector<float>> m_distances;  // Squared distance of each of m_results[id] from the searching boid.
+
+    // Verlet neighbor lists. Each ThreadWork keeps the lists of its own boids in m_lists[id];
+    //   boid i's list is m_lists[id][m_list_begin[i], m_list_end[i]).
+    float m_skin = 0.0f;
+    bool m_lists_valid = false;
+    bool m_rebuild_lists = false;
+    ptrdiff_t m_list_count = 0;
+    std::vector<QuadtreeResults> m_lists;
+    std::vector<uint32_t> m_list_begin, m_list_end;
+    std::vector<float> m_list_x, m_list_y;
+
+    bool m_count_searches = false;
+    std::vector<SearchCounters> m_search_counters;
 };
 
 
 void ThreadWork::operator()() const {
+    ProfileScope profile {ThreadWorkZone};
+    CounterScope counters;  // Pool threads. Work done on the calling thread is already counted around update.
     //{
     //    std::unique_lock<std::mutex> lock(algorithm->m_mutex);
     //    std::cout << "Thread " << id << " processing " << count << " boids starting at " << start << ".\n";
     //}
-    const Boidtree &tree = algorithm->m_tree;
+    const FrozenBoidtree &tree = algorithm->m_frozen;
     const Rectangle bounds = algorithm->m_bounds;
     auto &results = algorithm->m_results[id];
+    auto &distances = algorithm->m_distances[id];
     const float disruptive_radius = Boid::disruptiveRadius * Boid::disruptiveRadius;
     const float cohesive_radius = Boid::cohesiveRadius * Boid::cohesiveRadius;
 
     const Rectangle center_bound{bounds * 0.75f};
     const Rectangle hard_bound{bounds * 0.90f};
 
-    Rectangle search_bound{Vector{Boid::cohesiveRadius}};
-    for (ptrdiff_t i = start; i < start + count; ++i) {
-        const Boid current = read[i];
-        const Boid *previous = read + i;
-
-        search_bound.center = current.position;
-        Vector center_steer{0.0f, 0.0f};
+    // Kept local and added once at the end so threads don't share cache lines while counting.
+    const bool count_searches = algorithm->m_count_searches;
+    SearchCounters counted {};
+
+    // Searches cover the cohesive radius as a circle, which leaves out the corners a square would bring in.
+    // Plain searches hand their squared distances on to the sums. Neighbor lists are searched with a wider circle,
+    //   then filtered by the same distance tests, measured again each update since the boids have moved.
+    const bool use_lists = algorithm->m_skin > 0.0f;
+    const bool rebuild_lists = algorithm->m_rebuild_lists;
+    auto &lists = algorithm->m_lists[id];
+    if (rebuild_lists) {
+        lists.clear();
+    }
 
-        const bool in_center = center_bound.contains(current.position);
-        float center_steer_weight = Boid::primadonnaWeight;
-        if (!in_center) {
-            if (!hard_bound.contains(current.position)) {
-                center_steer_weight *= 2.0f;
+    // Searches and neighbor sums run one boid at a time. The rest of the step runs a block of boids at once.
+    SteeringBlock block;
+    Circle search_area {Vector {0.0f}, Boid::cohesiveRadius + algorithm->m_skin};
+    const ptrdiff_t end = start + count;
+    for (ptrdiff_t first = start; first < end; first += SteeringBlock::Capacity) {
+        const auto block_count = static_cast<size_t>(std::min<ptrdiff_t>(SteeringBlock::Capacity, end - first));
+        for (size_t lane = 0; lane < block_count; ++lane) {
+            const auto self = static_cast<uint32_t>(first + lane);
+            const Vector position = read->position(self);
+            search_area.center = position;
+
+            // Search into this boid's new list, or into the scratch results when lists are off.
+            auto &found = use_lists ? lists : results;
+            std::vector<float> *measured = use_lists ? nullptr : &distances;
+            if (!use_lists) {
+                results.clear();
+                distances.clear();
             }
 
-            center_steer -= current.position;
-            center_steer = steer(center_steer, current.velocity);
-        }
-
-        const Vector full_speed = steer(current.velocity, current.velocity);
-
-        results.clear();
-        search(tree, previous, search_bound, results);
-        //std::sort(
-        //    results.begin(), results.end(),
-        //    [&current](const Boid &a, const Boid &b) {
-        //        return glm::distance2(current.position, a.position) < glm::distance2(current.position, b.position);
-        //    }
-        //);
-
-        Vector separation{0.0f, 0.0f};
-        Vector alignment{0.0f, 0.0f};
-        Vector cohesion{0.0f, 0.0f};
-        size_t cohesive_total = 0;
-        size_t disruptive_total = 0;
-
-        for (const Boid &other : results) {
-            const float d2 = glm::distance2(current.position, other.position);
-
-            const size_t is_disruptive = d2 < disruptive_radius;
-            const size_t is_cohesive = d2 < cohesive_radius;
-
-            separation += FloatEnable[is_disruptive] * ((current.position - other.position) / (d2 + Epsilon));
-            alignment += FloatEnable[is_cohesive] * other.velocity;
-            cohesion += FloatEnable[is_cohesive] * other.position;
-
-            disruptive_total += is_disruptive;
-            cohesive_total += is_cohesive;
-
-            //if (d2 < disruptiveRadius) {
-            //    separation += (current.position - other.position) / d2 + epsilon;
-            //    disruptive_total++;
-            //}
-
-            //if (d2 < cohesiveRadius) {
-            //    alignment += other.velocity;
-            //    cohesion += other.position;
-            //    cohesive_total++;
-            //}
-        }
-
-        if (disruptive_total > 0) {
-            separation /= static_cast<float>(disruptive_total);
-            separation = steer(separation, current.velocity);
-        }
-
-        if (cohesive_total > 0) {
-            const float countFactor = 1.0f / static_cast<float>(cohesive_total);
-            alignment *= countFactor;
-
-            cohesion *= countFactor;
-            cohesion -= current.position;
+            if (use_lists && !rebuild_lists) {
+                ++counted.searches;
+                counted.candidates += algorithm->m_list_end[self] - algorithm->m_list_begin[self];
+                counted.returned += algorithm->m_list_end[self] - algorithm->m_list_begin[self];
+            } else {
+                const auto list_begin = static_cast<uint32_t>(found.size());
+                if (count_searches) {
+                    search(tree, *read, self, search_area, found, measured, counted);
+                } else {
+                    search(tree, *read, self, search_area, found, measured);
+                }
+
+                if (use_lists) {
+                    algorithm->m_list_begin[self] = list_begin;
+                    algorithm->m_list_end[self] = static_cast<uint32_t>(found.size());
+                }
+            }
 
-            alignment = steer(alignment, current.velocity);
-            cohesion = steer(cohesion, current.velocity);
+            const std::span<const uint32_t> neighbors = use_lists ?
+                std::span<const uint32_t> {lists}.subspan(
+                    algorithm->m_list_begin[self], algorithm->m_list_end[self] - algorithm->m_list_begin[self]
+                ) :
+                std::span<const uint32_t> {results};
+
+            const NeighborSums sums = use_lists ?
+                accumulate_neighbors(position, *read, neighbors, disruptive_radius, cohesive_radius) :
+                accumulate_neighbors(position, *read, neighbors, distances, disruptive_radius, cohesive_radius);
+            counted.cohesive += sums.cohesive;
+            counted.disruptive += sums.disruptive;
+            block.set(lane, sums);
         }
 
-        const Vector acceleration = magnitude(
-            Vector{center_steer * center_steer_weight + full_speed * Boid::speedWeight +
-                   separation * Boid::separationWeight + alignment * Boid::alignmentWeight +
-                   cohesion * Boid::cohesionWeight},
-            Boid::maxForce);
+        steer_block(block, block_count, *read, *write, first, center_bound, hard_bound, delta);
+    }
 
-        write[i].velocity += acceleration;
-        write[i].position += current.velocity * delta;
+    if (count_searches) {
+        algorithm->m_search_counters[id] = counted;
     }
 }
@@ -2,20 +2,32 @@
 #include "Core/Lua/VirtualMachine.hpp"
 #include "Core/Window/Window.hpp"
 
-// #include "Algorithm/DirectLoopAlgorithm.hpp"
-// #include "Algorithm/QuadtreeAlgorithm.hpp"
-// #include "Algorithm/ThreadedAlgorithm.hpp"
-// #include "Algorithm/DirectComputeAlgorithm.hpp"
+#include <cmath>
+#include <iomanip>
 
 #include "binary_default_lua.cpp"
 
-// #define FLOX_DEBUG_TIMINGS
+// Set by CMake from git describe when the build is configured.
+#ifndef FLOX_GIT_VERSION
+#define FLOX_GIT_VERSION "unknown"
+#endif
 
+// import DirectLoopAlgorithm;
+// import QuadtreeAlgorithm;
+// import DirectComputeAlgorithm;
 import Boid;
+import BoidStore;
+import Boidtree;
 import Camera;
 import Flock;
 import FlockRenderer;
+import FrameCapture;
+import GridAlgorithm;
+import HardwareCounters;
+import Profiler;
+import TraceRecorder;
 import Rectangle;
+import Steering;
 import RectangleRenderer;
 import ThreadedAlgorithm;
 import QuadtreeRenderer;
@@ -71,22 +83,138 @@ namespace app {
         int width;
         int height;
     };
+
+    // Headless runs drive the flock for a fixed number of frames without touching GLFW, Glad, or LWVL.
+    // Fixed-timestep windowed runs advance by whole timesteps too, so both reproduce the same trajectory.
+    struct SimulationConfiguration {
+        bool headless;
+        int frames;
+        float timestep;
+        bool fixed_timestep;
+        int max_substeps;  // Per rendered frame. Time beyond this is dropped.
+        uint32_t seed;     // Starting layout. 0 is the spiral.
+        std::string simd;  // Neighbor kernel, one of SimdLevelNames. Empty picks the best the CPU supports.
+        std::string algorithm;  // "threaded" searches a quadtree, "grid" a uniform grid.
+        int reorder_interval;   // Sort the flock into Morton order every this many updates. 0 never sorts.
+        float neighbor_skin;    // Extra search radius for cached neighbor lists in the threaded algorithm. 0 searches every update.
+        bool incremental_tree;  // Move boids between the threaded algorithm's quadtree leaves instead of rebuilding it.
+    };
+
+    // Runtime diagnostics. Unlike FLOX_SHOW_DEBUG_INFO, these are available in release builds.
+    struct DebugConfiguration {
+        bool profile;
+        bool counters;  // Hardware performance counters around Algorithm::update. Linux only.
+        std::string trace_path;  // Chrome trace-event JSON. Empty disables tracing.
+        int trace_start;
+        int trace_frames;
+        std::string capture_path;  // Per-frame timings as CSV. Empty disables the capture.
+        int capture_warmup;
+        int capture_frames;
+    };
+
+    struct Configuration {
+        size_t flock_size;
+        float world_bound;
+        WindowConfiguration window;
+        SimulationConfiguration simulation;
+        DebugConfiguration debug;
+    };
 }
 
+const ProfileZone EventsZone {"events"};
+const ProfileZone FlockUpdateZone {"flock update"};
+const ProfileZone RenderUpdateZone {"render update"};
+const ProfileZone RenderZone {"render"};
+
 
-void run_startup_script(
-    lua::VirtualMachine &L, size_t &flock_size, float &world_bound,
-    app::WindowConfiguration &window
+static CaptureMetadata capture_metadata(
+    app::Configuration const &config, Algorithm const &algorithm, const int thread_count
 ) {
+    return {
+        config.flock_size, thread_count, algorithm.name(), Boidtree::BucketItemCount,
+        SimdLevelNames[static_cast<size_t>(simd_level())], FLOX_GIT_VERSION
+    };
+}
+
+
+// Levels the CPU lacks fall back to the best one it has.
+static void select_simd_level(std::string const &name) {
+    const auto found = std::find(SimdLevelNames.begin(), SimdLevelNames.end(), name);
+    if (found == SimdLevelNames.end()) {
+        std::cout << "Unknown SIMD level " << name << ", using "
+                  << SimdLevelNames[static_cast<size_t>(simd_level())] << ".\n";
+        return;
+    }
+
+    const auto requested = static_cast<SimdLevel>(found - SimdLevelNames.begin());
+    set_simd_level(requested);
+    if (simd_level() != requested) {
+        std::cout << "SIMD level " << name << " is unsupported on this CPU, using "
+                  << SimdLevelNames[static_cast<size_t>(simd_level())] << ".\n";
+    }
+}
+
+
+// The threaded algorithm always exists because the quadtree renderer and statistics read its tree.
+// The grid is only built when it is asked for.
+static Algorithm *select_algorithm(
+    std::string const &name, ThreadedAlgorithm &threaded, std::optional<GridAlgorithm> &grid, const Vector bounds
+) {
+    if (name == "grid") {
+        return &grid.emplace(bounds);
+    }
+
+    if (name != threaded.name()) {
+        std::cout << "Unknown algorithm " << name << ", using " << threaded.name() << ".\n";
+    }
+
+    return &threaded;
+}
+
+
+static Vector world_bounds(const float world_bound, const float aspect) {
+    return {
+        aspect >= 1.0f ? world_bound * aspect : world_bound,
+        aspect < 1.0f ? world_bound * aspect : world_bound
+    };
+}
+
+
+// A zero, negative or non-finite timestep would stall the accumulator or turn it into NaN.
+static float valid_timestep(const float timestep, const float fallback) {
+    return std::isfinite(timestep) && timestep > 0.0f ? timestep : fallback;
+}
+
+
+void run_startup_script(lua::VirtualMachine &L, app::Configuration &config) {
     L.add_basic_libraries();
 
     // Create config table for Lua customization.
     lua::Table app_config {L.table("flox")};
-    app_config.create(4, 0);
-    app_config.push_integer("flock_size", static_cast<int>(flock_size));
-    app_config.push_number("world_bound", world_bound);
-    app_config.push_integer("width", window.width);
-    app_config.push_integer("height", window.height);
+    app_config.create(0, 23);
+    app_config.push_integer("flock_size", static_cast<int>(config.flock_size));
+    app_config.push_number("world_bound", config.world_bound);
+    app_config.push_integer("width", config.window.width);
+    app_config.push_integer("height", config.window.height);
+    app_config.push_boolean("headless", config.simulation.headless);
+    app_config.push_integer("headless_frames", config.simulation.frames);
+    app_config.push_number("timestep", config.simulation.timestep);
+    app_config.push_boolean("fixed_timestep", config.simulation.fixed_timestep);
+    app_config.push_integer("max_substeps", config.simulation.max_substeps);
+    app_config.push_integer("seed", config.simulation.seed);
+    app_config.push_string("simd", config.simulation.simd.c_str());
+    app_config.push_string("algorithm", config.simulation.algorithm.c_str());
+    app_config.push_integer("reorder_interval", config.simulation.reorder_interval);
+    app_config.push_number("neighbor_skin", config.simulation.neighbor_skin);
+    app_config.push_boolean("incremental_tree", config.simulation.incremental_tree);
+    app_config.push_boolean("profile", config.debug.profile);
+    app_config.push_boolean("counters", config.debug.counters);
+    app_config.push_string("trace_path", config.debug.trace_path.c_str());
+    app_config.push_integer("trace_start", config.debug.trace_start);
+    app_config.push_integer("trace_frames", config.debug.trace_frames);
+    app_config.push_string("capture_path", config.debug.capture_path.c_str());
+    app_config.push_integer("capture_warmup", config.debug.capture_warmup);
+    app_config.push_integer("capture_frames", config.debug.capture_frames);
     L.push_global(app_config);
 
     const bool valid_lua = [](lua::VirtualMachine &L) {
@@ -112,23 +240,401 @@ void run_startup_script(
     }(L);
 
     if (valid_lua && app_config.push()) {
-        flock_size = app_config.to_integer("flock_size", flock_size);
-        world_bound = app_config.to_number("world_bound", world_bound);
-        window.width = app_config.to_integer("width", window.width);
-        window.height = app_config.to_integer("height", window.height);
+        config.flock_size = app_config.to_integer("flock_size", config.flock_size);
+        config.world_bound = app_config.to_number("world_bound", config.world_bound);
+        config.window.width = app_config.to_integer("width", config.window.width);
+        config.window.height = app_config.to_integer("height", config.window.height);
+        config.simulation.headless = app_config.to_boolean("headless", config.simulation.headless);
+        config.simulation.frames = app_config.to_integer("headless_frames", config.simulation.frames);
+        config.simulation.timestep = valid_timestep(
+            app_config.to_number("headless_timestep", config.simulation.timestep), config.simulation.timestep
+        );
+        config.simulation.timestep = valid_timestep(
+            app_config.to_number("timestep", config.simulation.timestep), config.simulation.timestep
+        );
+        config.simulation.fixed_timestep = app_config.to_boolean("fixed_timestep", config.simulation.fixed_timestep);
+        config.simulation.max_substeps = std::max(
+            app_config.to_integer("max_substeps", config.simulation.max_substeps), 1
+        );
+        config.simulation.seed = app_config.to_integer("seed", config.simulation.seed);
+        config.simulation.simd = app_config.to_string("simd", config.simulation.simd);
+        config.simulation.algorithm = app_config.to_string("algorithm", config.simulation.algorithm);
+        config.simulation.reorder_interval = std::max(
+            app_config.to_integer("reorder_interval", config.simulation.reorder_interval), 0
+        );
+        config.simulation.neighbor_skin = std::max(
+            app_config.to_number("neighbor_skin", config.simulation.neighbor_skin), 0.0f
+        );
+        config.simulation.incremental_tree = app_config.to_boolean(
+            "incremental_tree", config.simulation.incremental_tree
+        );
+        config.debug.profile = app_config.to_boolean("profile", config.debug.profile);
+        config.debug.counters = app_config.to_boolean("counters", config.debug.counters);
+        config.debug.trace_path = app_config.to_string("trace_path", config.debug.trace_path);
+        config.debug.trace_start = app_config.to_integer("trace_start", config.debug.trace_start);
+        config.debug.trace_frames = app_config.to_integer("trace_frames", config.debug.trace_frames);
+        config.debug.capture_path = app_config.to_string("capture_path", config.debug.capture_path);
+        config.debug.capture_warmup = app_config.to_integer("capture_warmup", config.debug.capture_warmup);
+        config.debug.capture_frames = app_config.to_integer("capture_frames", config.debug.capture_frames);
         app_config.pop();
     }
 }
 
 
-int run() {
-    size_t flock_size = 1024;
-    float world_bound = 500.0f;
-    app::WindowConfiguration window_configuration {800, 450};
+// Command line options override anything set by the startup script.
+//   --headless            Run the simulation without a window.
+//   --frames <count>      Number of frames to simulate in headless mode.
+//   --timestep <seconds>  Fixed frame delta used in headless and fixed-timestep mode.
+//   --fixed-timestep      Step the windowed simulation by whole timesteps instead of the wall-clock frame time.
+//   --max-substeps <count> Most timesteps run in one rendered frame.
+//   --seed <seed>         Scatter the starting flock with this seed instead of using the spiral.
+//   --simd <level>        Neighbor kernel: scalar, sse4, avx2 or avx512. Defaults to the best supported.
+//   --algorithm <name>    Neighbor search: threaded (quadtree) or grid.
+//   --reorder <count>     Sort the flock into Morton order every count updates. 0 turns sorting off.
+//   --neighbor-skin <distance> Cache neighbor lists searched this far past the cohesive radius. 0 turns caching off.
+//   --incremental-tree    Keep the quadtree between updates, moving only boids that left their leaf.
+//   --profile             Print per-zone frame timings.
+//   --counters            Print hardware performance counters per frame and per boid.
+//   --trace <path>        Write a Chrome trace of the profiled zones.
+//   --trace-start <frame> First traced frame.
+//   --trace-frames <count> Number of traced frames.
+//   --capture <path>      Write per-frame timings as CSV, then exit.
+//   --capture-warmup <count> Frames to skip before capturing.
+//   --capture-frames <count> Number of captured frames.
+void parse_arguments(std::vector<std::string> const &arguments, app::Configuration &config) {
+    for (size_t i = 1; i < arguments.size(); ++i) {
+        std::string const &argument = arguments[i];
+        const bool has_value = i + 1 < arguments.size();
+        try {
+            if (argument == "--headless") {
+                config.simulation.headless = true;
+            } else if (argument == "--frames" && has_value) {
+                config.simulation.frames = std::stoi(arguments[++i]);
+            } else if (argument == "--timestep" && has_value) {
+                config.simulation.timestep = valid_timestep(std::stof(arguments[++i]), config.simulation.timestep);
+            } else if (argument == "--fixed-timestep") {
+                config.simulation.fixed_timestep = true;
+            } else if (argument == "--max-substeps" && has_value) {
+                config.simulation.max_substeps = std::max(std::stoi(arguments[++i]), 1);
+            } else if (argument == "--seed" && has_value) {
+                config.simulation.seed = static_cast<uint32_t>(std::stoul(arguments[++i]));
+            } else if (argument == "--simd" && has_value) {
+                config.simulation.simd = arguments[++i];
+            } else if (argument == "--algorithm" && has_value) {
+                config.simulation.algorithm = arguments[++i];
+            } else if (argument == "--reorder" && has_value) {
+                config.simulation.reorder_interval = std::max(std::stoi(arguments[++i]), 0);
+            } else if (argument == "--neighbor-skin" && has_value) {
+                config.simulation.neighbor_skin = std::max(std::stof(arguments[++i]), 0.0f);
+            } else if (argument == "--incremental-tree") {
+                config.simulation.incremental_tree = true;
+            } else if (argument == "--profile") {
+                config.debug.profile = true;
+            } else if (argument == "--counters") {
+                config.debug.counters = true;
+            } else if (argument == "--trace" && has_value) {
+                config.debug.trace_path = arguments[++i];
+            } else if (argument == "--trace-start" && has_value) {
+                config.debug.trace_start = std::stoi(arguments[++i]);
+            } else if (argument == "--trace-frames" && has_value) {
+                config.debug.trace_frames = std::stoi(arguments[++i]);
+            } else if (argument == "--capture" && has_value) {
+                config.debug.capture_path = arguments[++i];
+            } else if (argument == "--capture-warmup" && has_value) {
+                config.debug.capture_warmup = std::stoi(arguments[++i]);
+            } else if (argument == "--capture-frames" && has_value) {
+                config.debug.capture_frames = std::stoi(arguments[++i]);
+            } else {
+                std::cout << "Ignoring unknown argument: " << argument << '\n';
+            }
+        } catch (const std::logic_error &) {
+            std::cout << "Invalid value for argument: " << argument << '\n';
+        }
+    }
+}
+
+
+// Lua: QuadtreeStatistics() returns the shape of the tree built during the last flock update.
+static int lua_quadtree_statistics(lua_State *state) {
+    const auto *tree = static_cast<FrozenBoidtree const *>(lua_touserdata(state, lua_upvalueindex(1)));
+    const FrozenBoidtree::Statistics statistics {tree->statistics()};
+
+    const auto set_integer = [state](const char *key, const size_t value) {
+        lua_pushinteger(state, static_cast<lua_Integer>(value));
+        lua_setfield(state, -2, key);
+    };
+
+    // Lua arrays start at 1, so depth or fill n is stored at n + 1.
+    const auto set_array = [state](const char *key, auto const &values) {
+        lua_createtable(state, static_cast<int>(values.size()), 0);
+        for (size_t i = 0; i < values.size(); ++i) {
+            lua_pushinteger(state, static_cast<lua_Integer>(values[i]));
+            lua_rawseti(state, -2, static_cast<lua_Integer>(i + 1));
+        }
+        lua_setfield(state, -2, key);
+    };
+
+    lua_createtable(state, 0, 11);
+    set_integer("nodes", statistics.nodes);
+    set_integer("leaves", statistics.leaves);
+    set_integer("items", statistics.items);
+    set_integer("buckets", statistics.buckets);
+    set_integer("chained_leaves", statistics.chained_leaves);
+    set_integer("longest_chain", statistics.longest_chain);
+    set_integer("wasted_slots", statistics.wasted_slots);
+    set_integer("wasted_bytes", statistics.wasted_bytes);
+    lua_pushnumber(state, statistics.average_chain);
+    lua_setfield(state, -2, "average_chain");
+    set_array("leaves_per_depth", statistics.leaves_per_depth);
+    set_array("bucket_fill", statistics.bucket_fill);
+    return 1;
+}
+
+static void add_quadtree_statistics(lua::VirtualMachine &L, FrozenBoidtree const &tree) {
+    lua_pushlightuserdata(L.state, const_cast<FrozenBoidtree *>(&tree));
+    lua_pushcclosure(L.state, lua_quadtree_statistics, 1);
+    lua_setglobal(L.state, "QuadtreeStatistics");
+}
+
+// The closure points at the algorithm's tree. Remove it before the algorithm goes out of scope.
+static void remove_quadtree_statistics(lua::VirtualMachine &L) {
+    lua_pushnil(L.state);
+    lua_setglobal(L.state, "QuadtreeStatistics");
+}
+
+static void report_quadtree(std::ostream &os, FrozenBoidtree::Statistics const &statistics) {
+    os << "Quadtree: " << statistics.nodes << " nodes, " << statistics.leaves << " leaves, "
+       << statistics.items << " items in " << statistics.buckets << " buckets, "
+       << statistics.wasted_slots << " empty slots (" << statistics.wasted_bytes / 1024 << " KiB).\n";
+    os << "Bucket chains: longest " << statistics.longest_chain << ", average " << statistics.average_chain
+       << ", " << statistics.chained_leaves << " leaves chained.\n";
+
+    os << "Leaves per depth:";
+    for (const size_t leaves: statistics.leaves_per_depth) {
+        os << ' ' << leaves;
+    }
+
+    os << "\nBuckets by fill:";
+    for (const size_t buckets: statistics.bucket_fill) {
+        os << ' ' << buckets;
+    }
+    os << '\n';
+}
+
+
+// Neighbor-search work in the last update, one row per ThreadWork slice, averaged per search.
+static void report_searches(std::ostream &os, std::vector<SearchCounters> const &counters) {
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+
+    os << std::left << std::setw(8) << "slice" << std::right << std::setw(10) << "searches" << std::setw(10) << "nodes"
+       << std::setw(12) << "candidates" << std::setw(10) << "returned" << std::setw(10) << "cohesive"
+       << std::setw(12) << "disruptive" << '\n';
+
+    const auto row = [&os](std::string const &label, SearchCounters const &row) {
+        const double per_search = 1.0 / static_cast<double>(std::max<uint64_t>(row.searches, 1));
+        os << std::left << std::setw(8) << label << std::right << std::setw(10) << row.searches
+           << std::fixed << std::setprecision(1)
+           << std::setw(10) << static_cast<double>(row.nodes) * per_search
+           << std::setw(12) << static_cast<double>(row.candidates) * per_search
+           << std::setw(10) << static_cast<double>(row.returned) * per_search
+           << std::setw(10) << static_cast<double>(row.cohesive) * per_search
+           << std::setw(12) << static_cast<double>(row.disruptive) * per_search << '\n';
+    };
+
+    SearchCounters total {};
+    for (size_t i = 0; i < counters.size(); ++i) {
+        row(std::to_string(i), counters[i]);
+        total += counters[i];
+    }
+    row("total", total);
+
+    // How much of the rectangular search is thrown away by the distance tests.
+    if (total.candidates > 0 && total.returned > 0) {
+        const auto returned = static_cast<double>(total.returned);
+        os << std::setprecision(3) << "returned/candidates " << returned / static_cast<double>(total.candidates)
+           << ", cohesive/returned " << static_cast<double>(total.cohesive) / returned << '\n';
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+
+// Statistics of whichever algorithm ran the last update.
+static void report_algorithm(
+    std::ostream &os, Algorithm const *algorithm, ThreadedAlgorithm const &threaded,
+    std::optional<GridAlgorithm> const &grid
+) {
+    if (grid && algorithm == &grid.value()) {
+        os << "Grid: " << grid->columns() << " x " << grid->rows() << " cells of " << grid->cell_size() << ".\n";
+        return;
+    }
+
+    report_quadtree(os, threaded.tree().statistics());
+    report_searches(os, threaded.search_counters());
+}
+
+
+// FNV-1a over the boid state, array by array in identity order. Equal checksums mean two runs produced
+//   bit-identical flocks, whether or not either was reordered.
+static uint64_t flock_checksum(Flock const &flock) {
+    uint64_t hash = 14695981039346656037ull;
+    BoidStore const &boids = flock.boids();
+    std::vector<uint32_t> slots(boids.count());
+    for (size_t i = 0; i < slots.size(); ++i) {
+        slots[flock.ids()[i]] = static_cast<uint32_t>(i);
+    }
+
+    for (size_t c = 0; c < BoidStore::ComponentCount; ++c) {
+        float const *array = boids.component(static_cast<BoidStore::Component>(c));
+        for (const uint32_t slot: slots) {
+            const auto *bytes = reinterpret_cast<const unsigned char *>(array + slot);
+            for (size_t b = 0; b < sizeof(float); ++b) {
+                hash ^= bytes[b];
+                hash *= 1099511628211ull;
+            }
+        }
+    }
+
+    return hash;
+}
+
+
+int run_headless(
+    lua::VirtualMachine &L, lua::Function &lua_on_frame_start, app::Configuration const &config, const Vector bounds
+) {
+    const size_t flock_size = config.flock_size;
+    app::SimulationConfiguration const &simulation = config.simulation;
+    Profiler &profiler = Profiler::get();
+    std::optional<TraceRecorder> trace;
+    if (!config.debug.trace_path.empty()) {
+        trace.emplace(config.debug.trace_path, config.debug.trace_start, config.debug.trace_frames);
+    }
+
+    Flock flock {flock_size, simulation.seed};
+    flock.reorder_every(simulation.reorder_interval);
+    ThreadedAlgorithm threaded_algorithm {bounds};
+    std::optional<GridAlgorithm> grid_algorithm;
+    Algorithm *algorithm = select_algorithm(simulation.algorithm, threaded_algorithm, grid_algorithm, bounds);
+    add_quadtree_statistics(L, threaded_algorithm.tree());
+    threaded_algorithm.count_searches(config.debug.profile);
+    threaded_algorithm.neighbor_skin(simulation.neighbor_skin);
+    threaded_algorithm.incremental_tree(simulation.incremental_tree);
+
+    std::optional<FrameCapture> capture;
+    if (!config.debug.capture_path.empty()) {
+        capture.emplace(
+            config.debug.capture_path, config.debug.capture_warmup, config.debug.capture_frames,
+            capture_metadata(config, *algorithm, threaded_algorithm.thread_count())
+        );
+    }
+
+    const float dt = simulation.timestep;
+    std::cout << "Simulating " << flock_size << " boids for " << simulation.frames << " frames at a "
+              << dt << "s timestep." << std::endl;
+
+    const auto simulation_start = high_resolution_clock::now();
+    double update_duration_total = 0.0;
+    for (int frame_count = 0; frame_count < simulation.frames; ++frame_count) {
+        const auto frame_start = high_resolution_clock::now();
+        if (lua_on_frame_start.push()) {
+            L.push_number(dt);
+            L.log(lua_on_frame_start.call());
+        }
+
+        const auto update_start = high_resolution_clock::now();
+        const int64_t zone_start = profiler.now();
+        flock.update(algorithm, dt);
+        profiler.lap(FlockUpdateZone.id(), zone_start);
+        update_duration_total += delta(update_start);
+
+        if (profiler.enabled()) {
+            profiler.end_frame();
+        }
+
+        if (trace) {
+            trace->end_frame();
+        }
+
+        if (capture) {
+            capture->end_frame(delta(frame_start));
+        }
+    }
+
+    const double simulation_duration = delta(simulation_start);
+    std::cout << "Simulated " << simulation.frames << " frames in " << simulation_duration << "s.\n";
+    if (simulation.frames > 0) {
+        const auto frames = static_cast<double>(simulation.frames);
+        std::cout << "Flock updates: " << update_duration_total / frames << "s average, "
+                  << static_cast<double>(flock_size) * frames / update_duration_total << " boid updates/s.\n";
+    }
+    std::cout << "Final state checksum: " << std::hex << std::setw(16) << std::setfill('0') << flock_checksum(flock)
+              << std::dec << std::setfill(' ') << '\n';
+
+    if (config.debug.profile) {
+        std::cout << '\n';
+        profiler.report(std::cout);
+        report_algorithm(std::cout, algorithm, threaded_algorithm, grid_algorithm);
+    }
+
+    if (HardwareCounters &counters = HardwareCounters::get(); counters.enabled()) {
+        std::cout << '\n';
+        counters.report(std::cout);
+    }
+
+    // OnExit runs after this returns, with the tree gone.
+    remove_quadtree_statistics(L);
+    return 0;
+}
+
+
+int run(std::vector<std::string> const &arguments) {
+    app::Configuration configuration {
+        1024, 500.0f,
+        app::WindowConfiguration {800, 450},
+        app::SimulationConfiguration {false, 3600, 1.0f / 60.0f, false, 4, 0, "", "threaded", 0, 0.0f, false},
+#ifdef FLOX_SHOW_DEBUG_INFO
+        app::DebugConfiguration {true, false, "", 120, 60, "", 1200, 600}
+#else
+        app::DebugConfiguration {false, false, "", 120, 60, "", 1200, 600}
+#endif
+    };
 
     auto &L {lua::VirtualMachine::get()};
-    run_startup_script(L, flock_size, world_bound, window_configuration);
+    run_startup_script(L, configuration);
+    parse_arguments(arguments, configuration);
     lua::Function lua_on_frame_start {L.function("OnFrameStart", 1, 0)};
+    lua::Function lua_on_exit {L.function("OnExit", 0, 0)};
+
+    Profiler &profiler = Profiler::get();
+    profiler.enable(configuration.debug.profile);
+
+    HardwareCounters &counters = HardwareCounters::get();
+    if (configuration.debug.counters && !counters.enable(true)) {
+        std::cout << "Hardware performance counters are unavailable on this system.\n";
+    }
+
+    if (!configuration.simulation.simd.empty()) {
+        select_simd_level(configuration.simulation.simd);
+    }
+
+    const size_t flock_size = configuration.flock_size;
+    const float world_bound = configuration.world_bound;
+    app::WindowConfiguration const &window_configuration = configuration.window;
+
+    if (configuration.simulation.headless) {
+        // Use the configured window dimensions so headless runs see the same world as windowed runs.
+        const float aspect = static_cast<float>(window_configuration.width)
+                             / static_cast<float>(window_configuration.height);
+        const int result = run_headless(L, lua_on_frame_start, configuration, world_bounds(world_bound, aspect));
+
+        if (lua_on_exit.push()) {
+            L.log(lua_on_exit.call());
+        }
+
+        return result;
+    }
 
     Window &window {Window::get()};
     window.create(
@@ -182,13 +688,12 @@ int run() {
     Color clear_color {0.0f, 0.0f, 0.0f, 1.0f};
 
     const float aspect = static_cast<float>(width) / static_cast<float>(height);
-    const Vector bounds {
-        aspect >= 1.0f ? world_bound * aspect : world_bound,
-        aspect < 1.0f ? world_bound * aspect : world_bound
-    };
+    const Vector bounds {world_bounds(world_bound, aspect)};
     const Rectangle bounding_box {bounds};
 
-    Flock flock {flock_size};
+    app::SimulationConfiguration const &simulation = configuration.simulation;
+    Flock flock {flock_size, simulation.seed};
+    flock.reorder_every(simulation.reorder_interval);
 
     // Unused algorithms are dead code, but having them as components allows easier testing.
     //DirectLoopAlgorithm direct_loop_algorithm{bounds};
@@ -199,8 +704,13 @@ int run() {
 
     //Algorithm* algorithm = &direct_loop_algorithm;
     //QuadtreeAlgorithm *qt_algorithm = &quadtree_algorithm;
+    std::optional<GridAlgorithm> grid_algorithm;
     ThreadedAlgorithm *qt_algorithm = &threaded_algorithm;
-    Algorithm *algorithm = &threaded_algorithm;
+    Algorithm *algorithm = select_algorithm(simulation.algorithm, threaded_algorithm, grid_algorithm, bounds);
+    add_quadtree_statistics(L, qt_algorithm->tree());
+    threaded_algorithm.count_searches(configuration.debug.profile);
+    threaded_algorithm.neighbor_skin(simulation.neighbor_skin);
+    threaded_algorithm.incremental_tree(simulation.incremental_tree);
     //Algorithm *algorithm = &compute_algorithm;
 
     Projection projection {
@@ -259,30 +769,33 @@ int run() {
     VisionShader vision_shader {projection};
     BoidShader *active_shader = &default_boid_shader;
 
+    std::optional<TraceRecorder> trace;
+    if (!configuration.debug.trace_path.empty()) {
+        trace.emplace(configuration.debug.trace_path, configuration.debug.trace_start, configuration.debug.trace_frames);
+    }
+
+    std::optional<FrameCapture> capture;
+    if (!configuration.debug.capture_path.empty()) {
+        capture.emplace(
+            configuration.debug.capture_path, configuration.debug.capture_warmup, configuration.debug.capture_frames,
+            capture_metadata(configuration, *algorithm, threaded_algorithm.thread_count())
+        );
+    }
+
 #ifdef FLOX_SHOW_DEBUG_INFO
     std::cout << "Setup took " << delta(setup_start) << " seconds." << std::endl;
     auto second_start = high_resolution_clock::now();
 #endif
     auto frame_start = high_resolution_clock::now();
 
-#ifdef FLOX_SHOW_DEBUG_INFO
-    double event_duration_average = 0.0;
-    double update_duration_average = 0.0;
-    double render_update_duration_average = 0.0;
-    double render_duration_average = 0.0;
-#endif
+    // Unsimulated time carried between frames in fixed-timestep mode.
+    double accumulator = 0.0;
 
     //L.pushNumber(1.0 / 60.0);
     //L.setGlobal("fps");
 
     // glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
 
-#ifdef FLOX_DEBUG_TIMINGS
-    std::ofstream file;
-    file.open("UltimateFlox - Frame Times.txt");
-    int total_frame_count = 0;
-#endif
-
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     for (int frame_count = 1; !window.should_close(); frame_count++) {
@@ -290,13 +803,6 @@ int run() {
         const auto dt = static_cast<float>(delta(frame_start));
         frame_start = high_resolution_clock::now();
 
-#ifdef FLOX_DEBUG_TIMINGS
-        if (total_frame_count >= 1800) {
-            window.should_close(true);
-            continue;
-        }
-#endif
-
 
         if (lua_on_frame_start.push()) {
             L.push_number(dt);
@@ -305,9 +811,7 @@ int run() {
             // Nothing left on stack after call.
         }
 
-#ifdef FLOX_SHOW_DEBUG_INFO
-        auto average_start = high_resolution_clock::now();
-#endif
+        int64_t zone_start = profiler.now();
 
         // Fill event stack
         window.update();
@@ -455,19 +959,26 @@ int run() {
             }
         }
 
-#ifdef FLOX_SHOW_DEBUG_INFO
-        event_duration_average += delta(average_start);
-        average_start = high_resolution_clock::now();
-#else
-#ifdef FLOX_DEBUG_TIMINGS
-        auto averageStart = high_resolution_clock::now();
-#endif
-#endif
+        zone_start = profiler.lap(EventsZone.id(), zone_start);
 
         // Update engine
         bool do_updates = !paused && !console_open;
-        if (do_updates) {
+        if (do_updates && simulation.fixed_timestep) {
+            accumulator += dt;
+            int substeps = 0;
+            for (; accumulator >= simulation.timestep && substeps < simulation.max_substeps; ++substeps) {
+                flock.update(algorithm, simulation.timestep);
+                accumulator -= simulation.timestep;
+            }
+
+            // Too slow to keep up. Drop the backlog instead of running ever more substeps each frame.
+            if (substeps == simulation.max_substeps) {
+                accumulator = std::fmod(accumulator, static_cast<double>(simulation.timestep));
+            }
+        } else if (do_updates) {
             flock.update(algorithm, dt);
+        } else {
+            accumulator = 0.0;
         }
 
         //if (render_quadtree_colored || render_quadtree_lines) {
@@ -478,24 +989,7 @@ int run() {
         //    }
         //}
 
-#ifdef FLOX_DEBUG_TIMINGS
-        auto update_delta = duration_cast<microseconds>(
-            high_resolution_clock::now() - average_start
-        ).count();
-        if (total_frame_count > 1199) {
-            if (total_frame_count == 1200) {
-                std::cout << "Started timing capture." << std::endl;
-                file << update_delta;
-            } else {
-                file << ',' << update_delta;
-            }
-        }
-        ++total_frame_count;
-#endif
-#ifdef FLOX_SHOW_DEBUG_INFO
-        update_duration_average += delta(average_start);
-        average_start = high_resolution_clock::now();
-#endif
+        zone_start = profiler.lap(FlockUpdateZone.id(), zone_start);
 
         // Rendering
         if (render_boids || render_vision) {
@@ -512,10 +1006,7 @@ int run() {
             rectangle_renderer.update();
         }
 
-#ifdef FLOX_SHOW_DEBUG_INFO
-        render_update_duration_average += delta(average_start);
-        average_start = high_resolution_clock::now();
-#endif
+        zone_start = profiler.lap(RenderUpdateZone.id(), zone_start);
 
         if (!render_quadtree_colored) {
             glClearColor(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
@@ -549,9 +1040,22 @@ int run() {
 
         window.swap_buffers();
 
-#ifdef FLOX_SHOW_DEBUG_INFO
-        render_duration_average += delta(average_start);
-#endif
+        profiler.lap(RenderZone.id(), zone_start);
+        if (profiler.enabled()) {
+            profiler.end_frame();
+        }
+
+        if (trace) {
+            trace->end_frame();
+        }
+
+        // Captures are for unattended comparison runs, so close once the file is written.
+        if (capture) {
+            capture->end_frame(delta(frame_start));
+            if (capture->finished()) {
+                window.should_close(true);
+            }
+        }
 
         if (delta(frame_start) <= 0.008) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -562,26 +1066,25 @@ int run() {
 #ifdef FLOX_SHOW_DEBUG_INFO
             double fps = 64.0 / delta(second_start);
             second_start = high_resolution_clock::now();
-            const auto frameth = 1.0 / static_cast<double>(frame_count);
             std::cout << "Average framerate for last " << frame_count << " frames: " << fps << " | " << 1.0 / fps << 's'
                       << '\n';
-            std::cout << "Event updates: " << event_duration_average * frameth << "s, ";
-            std::cout << "Flock updates: " << update_duration_average * frameth << "s, ";
-            std::cout << "Rendering Updates: " << render_update_duration_average * frameth << "s, ";
-            std::cout << "Rendering: " << render_duration_average * frameth << 's' << '\n';
-            std::cout << '\n';
-
-            // Reset time variables.
-            event_duration_average = 0.0;
-            update_duration_average = 0.0;
-            render_update_duration_average = 0.0;
-            render_duration_average = 0.0;
 #endif
+            if (configuration.debug.profile) {
+                profiler.report(std::cout);
+                report_algorithm(std::cout, algorithm, threaded_algorithm, grid_algorithm);
+                std::cout << '\n';
+                profiler.reset();
+            }
+
+            if (counters.enabled()) {
+                counters.report(std::cout);
+                std::cout << '\n';
+                counters.reset();
+            }
             frame_count = 0;
         }
     }
 
-    lua::Function lua_on_exit {L.function("OnExit", 0, 0)};
     if (lua_on_exit.push()) {
         L.log(lua_on_exit.call());
     }
@@ -600,14 +1103,30 @@ int run() {
 //    int iCmdShow             // Start window maximized, minimized, etc.
 //)
 //#else // NDEBUG
-int wmain()
+int wmain(int argc, wchar_t *argv[])
 //#endif // NDEBUG
 #else // WIN32
-int main()
+int main(int argc, char *argv[])
 #endif // WIN32
 {
+    std::vector<std::string> arguments;
+    arguments.reserve(argc);
+    for (int i = 0; i < argc; ++i) {
+#ifdef WIN32
+        // Options are plain ASCII, so a narrowing copy is enough here.
+        const std::wstring_view wide {argv[i]};
+        std::string &argument = arguments.emplace_back();
+        argument.reserve(wide.size());
+        for (const wchar_t c: wide) {
+            argument.push_back(static_cast<char>(c));
+        }
+#else
+        arguments.emplace_back(argv[i]);
+#endif
+    }
+
     try {
-        return run();
+        return run(arguments);
     } catch (const std::bad_alloc &e) {
         std::cerr << "Unable to allocate memory for program. Exiting." << std::endl;
         return -1;
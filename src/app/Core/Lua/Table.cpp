@@ -53,6 +53,12 @@ void lua::Table::push_string(const char *key, const char *value) {
     lua_settable(m_state, m_index);
 }
 
+void lua::Table::push_boolean(const char *key, bool value) {
+    lua_pushstring(m_state, key);
+    lua_pushboolean(m_state, value);
+    lua_settable(m_state, m_index);
+}
+
 lua_Integer lua::Table::to_integer(const char *key, int* isNum) {
     return to_value<lua_Integer>(key, isNum, lua_tointegerx);
 }
@@ -84,3 +90,14 @@ std::string lua::Table::to_string(const char *key, const std::string &backup) {
     lua_pop(m_state, 1);
     return value;
 }
+
+bool lua::Table::to_boolean(const char *key, bool backup) {
+    lua_pushstring(m_state, key);
+    lua_gettable(m_state, m_index);
+    bool value = backup;
+    if (lua_isboolean(m_state, -1)) {
+        value = lua_toboolean(m_state, -1);
+    }
+    lua_pop(m_state, 1);
+    return value;
+}
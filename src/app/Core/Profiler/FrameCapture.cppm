@@ -0,0 +1,142 @@
+module;
+#include "pch.hpp"
+#include <fstream>
+#include <iomanip>
+export module FrameCapture;
+
+import Profiler;
+
+
+// Describes the run a capture came from so two capture files can be compared without guessing.
+export struct CaptureMetadata {
+    size_t flock_size;
+    int thread_count;
+    std::string algorithm;
+    size_t bucket_size;
+    std::string simd;
+    std::string version;
+};
+
+
+// Records per-frame timings after a warmup and writes them as CSV once the capture length is reached.
+// Every profiled zone gets a column holding the zone's total time in that frame, summed over threads.
+// Metadata goes in leading '#' lines.
+export class FrameCapture {
+public:
+    FrameCapture(std::string path, const int warmup, const int frames, CaptureMetadata metadata) :
+        m_path(std::move(path)), m_warmup(std::max(warmup, 0)), m_frames(std::max(frames, 1)),
+        m_metadata(std::move(metadata))
+    {
+        Profiler &profiler = Profiler::get();
+        profiler.capture_samples(true);
+        m_rows.reserve(m_frames);
+    }
+
+    FrameCapture(FrameCapture const &) = delete;
+    FrameCapture(FrameCapture &&) = delete;
+
+    ~FrameCapture() {
+        if (!m_written && !m_rows.empty()) {
+            write();
+        }
+    }
+
+    // Call once per frame, after Profiler::end_frame(). frame_seconds is the whole frame's duration.
+    void end_frame(const double frame_seconds) {
+        if (m_written) {
+            return;
+        }
+
+        if (m_frame++ < m_warmup) {
+            return;
+        }
+
+        if (m_rows.empty()) {
+            std::cout << "Started frame capture.\n";
+        }
+
+        Row &row = m_rows.emplace_back(Row {frame_seconds, {}});
+        for (Profiler::Sample const &sample: Profiler::get().frame_samples()) {
+            if (sample.zone >= row.zones.size()) {
+                row.zones.resize(sample.zone + 1, 0.0);
+            }
+
+            row.zones[sample.zone] += 0.000000001 * static_cast<double>(sample.end - sample.start);
+        }
+
+        m_zone_count = std::max(m_zone_count, row.zones.size());
+        if (static_cast<int>(m_rows.size()) >= m_frames) {
+            write();
+        }
+    }
+
+    [[nodiscard]] bool finished() const {
+        return m_written;
+    }
+
+private:
+    struct Row {
+        double frame;
+        std::vector<double> zones;  // Seconds, indexed by zone id.
+    };
+
+    void write() {
+        m_written = true;
+        Profiler &profiler = Profiler::get();
+        profiler.capture_samples(false);
+
+        std::ofstream file {m_path};
+        if (!file) {
+            std::cerr << "Unable to open frame capture file " << m_path << '\n';
+            return;
+        }
+
+        file << "# version=" << m_metadata.version << '\n'
+             << "# algorithm=" << m_metadata.algorithm << '\n'
+             << "# flock_size=" << m_metadata.flock_size << '\n'
+             << "# thread_count=" << m_metadata.thread_count << '\n'
+             << "# bucket_size=" << m_metadata.bucket_size << '\n'
+             << "# simd=" << m_metadata.simd << '\n'
+             << "# warmup=" << m_warmup << '\n';
+
+        // Only zones that ran during the capture get a column.
+        std::vector<uint32_t> columns;
+        for (uint32_t zone = 0; zone < m_zone_count; ++zone) {
+            const bool used = std::any_of(m_rows.begin(), m_rows.end(), [zone](Row const &row) {
+                return zone < row.zones.size() && row.zones[zone] > 0.0;
+            });
+
+            if (used) {
+                columns.push_back(zone);
+            }
+        }
+
+        file << "frame,frame_ms";
+        for (const uint32_t zone: columns) {
+            file << ",\"" << profiler.zone_name(zone) << " ms\"";
+        }
+        file << '\n';
+
+        file << std::fixed << std::setprecision(4);
+        for (size_t i = 0; i < m_rows.size(); ++i) {
+            Row const &row = m_rows[i];
+            file << m_warmup + static_cast<int>(i) << ',' << row.frame * 1000.0;
+            for (const uint32_t zone: columns) {
+                file << ',' << (zone < row.zones.size() ? row.zones[zone] * 1000.0 : 0.0);
+            }
+            file << '\n';
+        }
+
+        std::cout << "Wrote " << m_rows.size() << " captured frames to " << m_path << '\n';
+    }
+
+    std::string m_path;
+    int m_warmup;
+    int m_frames;
+    CaptureMetadata m_metadata;
+
+    int m_frame = 0;
+    bool m_written = false;
+    size_t m_zone_count = 0;
+    std::vector<Row> m_rows;
+};
@@ -0,0 +1,279 @@
+module;
+#include "pch.hpp"
+#include <atomic>
+#include <iomanip>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+export module HardwareCounters;
+
+
+// CPU performance counters through Linux perf_event_open. Other platforms report nothing.
+// Every thread that runs simulation work opens its own counters the first time it enters a CounterScope.
+// Only user-space events are counted so the default perf_event_paranoid setting of 2 is enough.
+
+
+export class HardwareCounters {
+public:
+    enum Event : size_t {
+        Cycles,
+        Instructions,
+        L1DataMisses,
+        LastLevelMisses,
+        BranchMisses,
+        EventCount
+    };
+
+    using Values = std::array<uint64_t, EventCount>;
+
+    static HardwareCounters &get();
+
+    static constexpr std::array<const char *, EventCount> EventNames {
+        "cycles", "instructions", "L1d read misses", "LLC read misses", "branch misses"
+    };
+
+private:
+    struct ThreadCounters {
+        ThreadCounters();
+        ~ThreadCounters();
+
+        std::array<int, EventCount> descriptors {};
+    };
+
+    HardwareCounters() = default;
+
+    static ThreadCounters &local_counters();
+
+public:
+    HardwareCounters(HardwareCounters const &) = delete;
+    HardwareCounters(HardwareCounters &&) = delete;
+
+    // Returns false if no counter could be opened, for example outside Linux or inside most containers.
+    bool enable(bool value);
+
+    [[nodiscard]] bool enabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Current counts for the calling thread. Unavailable events read as zero.
+    void read(Values &values);
+
+    // Adds a measured span. Pass the boids updated by the span if it is an outermost Algorithm::update.
+    void add(Values const &start, Values const &end, size_t boids);
+
+    void report(std::ostream &os) const;
+    void reset();
+
+private:
+    std::atomic<bool> m_enabled {false};
+    std::array<std::atomic<bool>, EventCount> m_available {};
+
+    std::array<std::atomic<uint64_t>, EventCount> m_totals {};
+    std::atomic<uint64_t> m_updates {0};
+    std::atomic<uint64_t> m_boids {0};
+};
+
+
+// Counts the enclosing scope on the calling thread. Nested scopes on the same thread are ignored,
+//   so a scope around Algorithm::update and another around each worker's task never count the same work twice.
+export class CounterScope {
+public:
+    explicit CounterScope(const size_t boids = 0) : m_boids(boids) {
+        HardwareCounters &counters = HardwareCounters::get();
+        if (counters.enabled()) {
+            m_nested = s_depth++ > 0;
+            if (!m_nested.value()) {
+                counters.read(m_start);
+            }
+        }
+    }
+
+    CounterScope(CounterScope const &) = delete;
+    CounterScope(CounterScope &&) = delete;
+
+    ~CounterScope() {
+        if (!m_nested.has_value()) {
+            return;
+        }
+
+        --s_depth;
+        if (!m_nested.value()) {
+            HardwareCounters &counters = HardwareCounters::get();
+            HardwareCounters::Values end;
+            counters.read(end);
+            counters.add(m_start, end, m_boids);
+        }
+    }
+
+private:
+    static thread_local int s_depth;
+
+    HardwareCounters::Values m_start {};
+    size_t m_boids;
+    std::optional<bool> m_nested;  // Empty while counters are disabled.
+};
+
+
+thread_local int CounterScope::s_depth = 0;
+
+
+HardwareCounters &HardwareCounters::get() {
+    static HardwareCounters instance;
+    return instance;
+}
+
+#ifdef __linux__
+static int open_counter(const uint32_t type, const uint64_t config) {
+    perf_event_attr attributes {};
+    attributes.size = sizeof(attributes);
+    attributes.type = type;
+    attributes.config = config;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    // More events than hardware counters get multiplexed. These let read() scale the count back up.
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+
+static constexpr uint64_t cache_read_miss(const uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+HardwareCounters::ThreadCounters::ThreadCounters() {
+    descriptors[Cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    descriptors[Instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    descriptors[L1DataMisses] = open_counter(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_L1D));
+    descriptors[LastLevelMisses] = open_counter(PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_LL));
+    descriptors[BranchMisses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+}
+
+HardwareCounters::ThreadCounters::~ThreadCounters() {
+    for (const int descriptor: descriptors) {
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+    }
+}
+
+void HardwareCounters::read(Values &values) {
+    ThreadCounters &counters = local_counters();
+    for (size_t event = 0; event < EventCount; ++event) {
+        values[event] = 0;
+        const int descriptor = counters.descriptors[event];
+        if (descriptor < 0) {
+            continue;
+        }
+
+        struct {
+            uint64_t value;
+            uint64_t enabled;
+            uint64_t running;
+        } reading {};
+
+        if (::read(descriptor, &reading, sizeof(reading)) != sizeof(reading) || reading.running == 0) {
+            continue;
+        }
+
+        values[event] = reading.running == reading.enabled ? reading.value : static_cast<uint64_t>(
+            static_cast<double>(reading.value) * static_cast<double>(reading.enabled)
+            / static_cast<double>(reading.running)
+        );
+    }
+}
+#else
+HardwareCounters::ThreadCounters::ThreadCounters() {
+    descriptors.fill(-1);
+}
+
+HardwareCounters::ThreadCounters::~ThreadCounters() = default;
+
+void HardwareCounters::read(Values &values) {
+    values.fill(0);
+}
+#endif
+
+HardwareCounters::ThreadCounters &HardwareCounters::local_counters() {
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+bool HardwareCounters::enable(const bool value) {
+    if (!value) {
+        m_enabled.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    // The calling thread's counters decide which events get reported.
+    bool any = false;
+    ThreadCounters const &counters = local_counters();
+    for (size_t event = 0; event < EventCount; ++event) {
+        const bool available = counters.descriptors[event] >= 0;
+        m_available[event].store(available, std::memory_order_relaxed);
+        any |= available;
+    }
+
+    m_enabled.store(any, std::memory_order_relaxed);
+    return any;
+}
+
+void HardwareCounters::add(Values const &start, Values const &end, const size_t boids) {
+    for (size_t event = 0; event < EventCount; ++event) {
+        // Scaled multiplexed counts are estimates and can step backwards slightly.
+        if (end[event] > start[event]) {
+            m_totals[event].fetch_add(end[event] - start[event], std::memory_order_relaxed);
+        }
+    }
+
+    if (boids > 0) {
+        m_updates.fetch_add(1, std::memory_order_relaxed);
+        m_boids.fetch_add(boids, std::memory_order_relaxed);
+    }
+}
+
+void HardwareCounters::report(std::ostream &os) const {
+    const uint64_t updates = m_updates.load(std::memory_order_relaxed);
+    const uint64_t boids = m_boids.load(std::memory_order_relaxed);
+    if (updates == 0 || boids == 0) {
+        return;
+    }
+
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+
+    os << std::left << std::setw(40) << "hardware counter" << std::right << std::setw(16) << "per frame"
+       << std::setw(14) << "per boid" << '\n';
+    for (size_t event = 0; event < EventCount; ++event) {
+        os << std::left << std::setw(40) << EventNames[event] << std::right;
+        if (!m_available[event].load(std::memory_order_relaxed)) {
+            os << std::setw(16) << "n/a" << std::setw(14) << "n/a" << '\n';
+            continue;
+        }
+
+        const auto total = static_cast<double>(m_totals[event].load(std::memory_order_relaxed));
+        os << std::fixed << std::setprecision(0) << std::setw(16) << total / static_cast<double>(updates)
+           << std::setprecision(2) << std::setw(14) << total / static_cast<double>(boids) << '\n';
+    }
+
+    const auto cycles = static_cast<double>(m_totals[Cycles].load(std::memory_order_relaxed));
+    const auto instructions = static_cast<double>(m_totals[Instructions].load(std::memory_order_relaxed));
+    if (cycles > 0.0 && instructions > 0.0) {
+        os << std::left << std::setw(40) << "instructions per cycle" << std::right << std::fixed
+           << std::setprecision(2) << std::setw(16) << instructions / cycles << '\n';
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void HardwareCounters::reset() {
+    for (auto &total: m_totals) {
+        total.store(0, std::memory_order_relaxed);
+    }
+
+    m_updates.store(0, std::memory_order_relaxed);
+    m_boids.store(0, std::memory_order_relaxed);
+}
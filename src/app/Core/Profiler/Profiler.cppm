@@ -0,0 +1,291 @@
+module;
+#include "pch.hpp"
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+export module Profiler;
+
+
+// Scoped-zone profiler that stays compiled into release builds and costs one relaxed load while disabled.
+// Each thread writes finished zones into its own single-producer ring buffer. The main thread is the only consumer
+//   and drains every ring once per frame in end_frame(), so the hot path never takes a lock.
+// Zones are registered once, usually as a namespace-scope ProfileZone, and referred to by index after that.
+
+
+export class Profiler {
+public:
+    static Profiler &get();
+
+    static constexpr size_t RingCapacity = 1 << 14;  // Per thread. Must be a power of two.
+
+    struct Sample {
+        uint32_t zone;
+        uint32_t thread;
+        int64_t start;  // Nanoseconds since the profiler was created.
+        int64_t end;
+    };
+
+    struct ZoneStatistics {
+        std::string name;
+        size_t samples;
+        double p50, p95, p99, max;  // Seconds
+    };
+
+private:
+    struct alignas(64) ThreadRing {
+        explicit ThreadRing(uint32_t i) : samples(std::make_unique<Sample[]>(RingCapacity)), index(i) {}
+
+        std::unique_ptr<Sample[]> samples;
+        uint32_t index;
+        std::atomic<uint64_t> dropped {0};
+        alignas(64) std::atomic<uint64_t> head {0};  // Written by the producing thread.
+        alignas(64) std::atomic<uint64_t> tail {0};  // Written by the consumer.
+    };
+
+    Profiler() : m_epoch(std::chrono::steady_clock::now()) {}
+
+    ThreadRing &local_ring();
+
+    static thread_local ThreadRing *s_ring;
+
+public:
+    Profiler(Profiler const &) = delete;
+    Profiler(Profiler &&) = delete;
+
+    uint32_t register_zone(const char *name);
+
+    void enable(const bool value) {
+        m_enabled.store(value, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool enabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+    }
+
+    // Hot path. Called from any thread.
+    void record(uint32_t zone, int64_t start, int64_t end);
+
+    // For back-to-back zones that are awkward to scope. Records [start, now) and returns now.
+    int64_t lap(const uint32_t zone, const int64_t start) {
+        const int64_t end = now();
+        if (enabled()) {
+            record(zone, start, end);
+        }
+        return end;
+    }
+
+    // Main thread only. Moves every finished zone out of the thread rings.
+    void end_frame();
+
+    // Keep the raw samples drained by the last end_frame(). Counted, so a trace and a frame capture can overlap.
+    // Recording is switched on for the first capturer and put back as it was once the last one stops.
+    void capture_samples(const bool value) {
+        if (value && m_capture_samples++ == 0) {
+            m_enabled_before_capture = enabled();
+            enable(true);
+        } else if (!value && --m_capture_samples == 0) {
+            enable(m_enabled_before_capture);
+        }
+    }
+
+    [[nodiscard]] std::vector<Sample> const &frame_samples() const {
+        return m_frame_samples;
+    }
+
+    [[nodiscard]] std::string zone_name(uint32_t zone) const;
+
+    // Index of the calling thread's ring, as stored in Sample::thread.
+    [[nodiscard]] uint32_t thread_index() {
+        return local_ring().index;
+    }
+
+    [[nodiscard]] std::vector<ZoneStatistics> statistics() const;
+    void report(std::ostream &os) const;
+
+    // Forget the samples gathered so far. Zones stay registered.
+    void reset();
+
+private:
+    std::chrono::steady_clock::time_point m_epoch;
+    std::atomic<bool> m_enabled {false};
+
+    mutable std::mutex m_registry_mutex;
+    std::vector<std::string> m_zone_names;
+    std::vector<std::unique_ptr<ThreadRing>> m_rings;
+
+    // Consumer-side state. Durations in seconds per zone since the last reset.
+    std::vector<std::vector<double>> m_durations;
+    uint64_t m_dropped = 0;
+    int m_capture_samples = 0;
+    bool m_enabled_before_capture = false;
+    std::vector<Sample> m_frame_samples;
+};
+
+
+// A named zone. Construct once and reuse; registration takes a lock.
+export class ProfileZone {
+public:
+    explicit ProfileZone(const char *name) : m_id(Profiler::get().register_zone(name)) {}
+
+    [[nodiscard]] uint32_t id() const {
+        return m_id;
+    }
+
+private:
+    uint32_t m_id;
+};
+
+
+// Times the enclosing scope as one sample of the given zone.
+export class ProfileScope {
+public:
+    explicit ProfileScope(ProfileZone const &zone) : m_zone(zone.id()) {
+        Profiler &profiler = Profiler::get();
+        if (profiler.enabled()) {
+            m_start = profiler.now();
+        }
+    }
+
+    ProfileScope(ProfileScope const &) = delete;
+    ProfileScope(ProfileScope &&) = delete;
+
+    ~ProfileScope() {
+        if (m_start >= 0) {
+            Profiler &profiler = Profiler::get();
+            profiler.record(m_zone, m_start, profiler.now());
+        }
+    }
+
+private:
+    uint32_t m_zone;
+    int64_t m_start = -1;
+};
+
+
+thread_local Profiler::ThreadRing *Profiler::s_ring = nullptr;
+
+
+Profiler &Profiler::get() {
+    static Profiler instance;
+    return instance;
+}
+
+Profiler::ThreadRing &Profiler::local_ring() {
+    if (s_ring == nullptr) [[unlikely]] {
+        std::lock_guard<std::mutex> lock(m_registry_mutex);
+        const auto index = static_cast<uint32_t>(m_rings.size());
+        s_ring = m_rings.emplace_back(std::make_unique<ThreadRing>(index)).get();
+    }
+
+    return *s_ring;
+}
+
+uint32_t Profiler::register_zone(const char *name) {
+    std::lock_guard<std::mutex> lock(m_registry_mutex);
+    const auto found = std::find(m_zone_names.begin(), m_zone_names.end(), name);
+    if (found != m_zone_names.end()) {
+        return static_cast<uint32_t>(found - m_zone_names.begin());
+    }
+
+    m_zone_names.emplace_back(name);
+    return static_cast<uint32_t>(m_zone_names.size() - 1);
+}
+
+void Profiler::record(const uint32_t zone, const int64_t start, const int64_t end) {
+    ThreadRing &ring = local_ring();
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    const uint64_t tail = ring.tail.load(std::memory_order_acquire);
+
+    // Full. The consumer has fallen behind by a whole ring, so drop rather than block.
+    if (head - tail >= RingCapacity) [[unlikely]] {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ring.samples[head & (RingCapacity - 1)] = Sample {zone, ring.index, start, end};
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::end_frame() {
+    std::lock_guard<std::mutex> lock(m_registry_mutex);
+    if (m_durations.size() < m_zone_names.size()) {
+        m_durations.resize(m_zone_names.size());
+    }
+
+    m_dropped = 0;
+    m_frame_samples.clear();
+    for (auto const &ring: m_rings) {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        for (; tail < head; ++tail) {
+            Sample const &sample = ring->samples[tail & (RingCapacity - 1)];
+            m_durations[sample.zone].push_back(0.000000001 * static_cast<double>(sample.end - sample.start));
+            if (m_capture_samples > 0) {
+                m_frame_samples.push_back(sample);
+            }
+        }
+
+        ring->tail.store(tail, std::memory_order_release);
+        m_dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+}
+
+std::string Profiler::zone_name(const uint32_t zone) const {
+    std::lock_guard<std::mutex> lock(m_registry_mutex);
+    return zone < m_zone_names.size() ? m_zone_names[zone] : std::string {};
+}
+
+std::vector<Profiler::ZoneStatistics> Profiler::statistics() const {
+    std::lock_guard<std::mutex> lock(m_registry_mutex);
+    std::vector<ZoneStatistics> result;
+    std::vector<double> sorted;
+    for (size_t zone = 0; zone < m_durations.size(); ++zone) {
+        std::vector<double> const &durations = m_durations[zone];
+        if (durations.empty()) {
+            continue;
+        }
+
+        sorted.assign(durations.begin(), durations.end());
+        std::sort(sorted.begin(), sorted.end());
+        const auto rank = [&sorted](const double p) {
+            return sorted[static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5)];
+        };
+
+        result.push_back({m_zone_names[zone], sorted.size(), rank(0.50), rank(0.95), rank(0.99), sorted.back()});
+    }
+
+    return result;
+}
+
+void Profiler::report(std::ostream &os) const {
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+
+    os << std::left << std::setw(40) << "zone" << std::right << std::setw(9) << "samples"
+       << std::setw(11) << "p50 ms" << std::setw(11) << "p95 ms" << std::setw(11) << "p99 ms"
+       << std::setw(11) << "max ms" << '\n';
+    os << std::fixed << std::setprecision(3);
+    for (ZoneStatistics const &zone: statistics()) {
+        os << std::left << std::setw(40) << zone.name << std::right << std::setw(9) << zone.samples
+           << std::setw(11) << zone.p50 * 1000.0 << std::setw(11) << zone.p95 * 1000.0
+           << std::setw(11) << zone.p99 * 1000.0 << std::setw(11) << zone.max * 1000.0 << '\n';
+    }
+
+    if (m_dropped > 0) {
+        os << m_dropped << " samples dropped by full thread rings.\n";
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(m_registry_mutex);
+    for (auto &durations: m_durations) {
+        durations.clear();
+    }
+}
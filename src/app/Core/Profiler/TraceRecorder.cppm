@@ -0,0 +1,140 @@
+module;
+#include "pch.hpp"
+#include <fstream>
+#include <iomanip>
+export module TraceRecorder;
+
+import Profiler;
+
+
+// Collects the profiler's samples for a range of frames and writes them as Chrome trace-event JSON.
+// Open the file in chrome://tracing or ui.perfetto.dev. Each profiler thread ring becomes one track.
+export class TraceRecorder {
+public:
+    TraceRecorder(std::string path, const int first_frame, const int frame_count) :
+        m_path(std::move(path)), m_first_frame(first_frame), m_last_frame(first_frame + std::max(frame_count, 1))
+    {
+        Profiler &profiler = Profiler::get();
+        profiler.capture_samples(true);
+        m_main_thread = profiler.thread_index();
+    }
+
+    TraceRecorder(TraceRecorder const &) = delete;
+    TraceRecorder(TraceRecorder &&) = delete;
+
+    ~TraceRecorder() {
+        // The window may close before the range ends. Keep what was recorded.
+        if (!m_written && !m_samples.empty()) {
+            write();
+        }
+    }
+
+    // Call once per frame, after Profiler::end_frame().
+    void end_frame() {
+        if (m_written) {
+            return;
+        }
+
+        Profiler &profiler = Profiler::get();
+        if (m_frame >= m_first_frame) {
+            std::vector<Profiler::Sample> const &samples = profiler.frame_samples();
+            m_samples.insert(m_samples.end(), samples.begin(), samples.end());
+            m_frame_ends.push_back(profiler.now());
+        }
+
+        if (++m_frame >= m_last_frame) {
+            write();
+        }
+    }
+
+    [[nodiscard]] bool finished() const {
+        return m_written;
+    }
+
+private:
+    void write() {
+        m_written = true;
+        Profiler &profiler = Profiler::get();
+        profiler.capture_samples(false);
+
+        std::ofstream file {m_path};
+        if (!file) {
+            std::cerr << "Unable to open trace file " << m_path << '\n';
+            return;
+        }
+
+        // Trace timestamps are microseconds.
+        file << std::fixed << std::setprecision(3);
+        const auto microseconds = [](const int64_t nanoseconds) {
+            return 0.001 * static_cast<double>(nanoseconds);
+        };
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        file << R"({"name":"process_name","ph":"M","pid":1,"tid":0,"args":{"name":"UltimateFlox"}})";
+
+        std::vector<uint32_t> threads;
+        for (Profiler::Sample const &sample: m_samples) {
+            if (std::find(threads.begin(), threads.end(), sample.thread) == threads.end()) {
+                threads.push_back(sample.thread);
+            }
+        }
+
+        for (const uint32_t thread: threads) {
+            file << ",\n" << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << thread << R"(,"args":{"name":")";
+            if (thread == m_main_thread) {
+                file << "main";
+            } else {
+                file << "worker " << thread;
+            }
+            file << "\"}}";
+        }
+
+        std::vector<std::string> names;
+        for (Profiler::Sample const &sample: m_samples) {
+            if (sample.zone >= names.size()) {
+                names.resize(sample.zone + 1);
+            }
+
+            if (names[sample.zone].empty()) {
+                names[sample.zone] = escape(profiler.zone_name(sample.zone));
+            }
+
+            file << ",\n" << R"({"name":")" << names[sample.zone] << R"(","cat":"flox","ph":"X","pid":1,"tid":)"
+                 << sample.thread << ",\"ts\":" << microseconds(sample.start)
+                 << ",\"dur\":" << microseconds(sample.end - sample.start) << '}';
+        }
+
+        for (size_t i = 0; i < m_frame_ends.size(); ++i) {
+            file << ",\n" << R"({"name":"frame )" << m_first_frame + static_cast<int>(i)
+                 << R"(","cat":"frame","ph":"i","s":"g","pid":1,"tid":)" << m_main_thread
+                 << ",\"ts\":" << microseconds(m_frame_ends[i]) << '}';
+        }
+
+        file << "\n]}\n";
+        std::cout << "Wrote " << m_samples.size() << " trace events for frames " << m_first_frame << " to "
+                  << m_first_frame + static_cast<int>(m_frame_ends.size()) - 1 << " to " << m_path << '\n';
+    }
+
+    static std::string escape(std::string const &text) {
+        std::string result;
+        result.reserve(text.size());
+        for (const char c: text) {
+            if (c == '"' || c == '\\') {
+                result.push_back('\\');
+            }
+            result.push_back(c);
+        }
+
+        return result;
+    }
+
+    std::string m_path;
+    int m_first_frame;
+    int m_last_frame;
+    int m_frame = 0;
+    uint32_t m_main_thread = 0;
+    bool m_written = false;
+
+    std::vector<Profiler::Sample> m_samples;
+    std::vector<int64_t> m_frame_ends;
+};
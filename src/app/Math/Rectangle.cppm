@@ -51,6 +51,27 @@ public:
     Vector size{0, 0};
 };
 
+// Search area for a neighbor radius. Holds the points strictly closer than radius to center, which is the test the
+//   steering step makes on its neighbors.
+export class Circle {
+public:
+    Circle() = default;
+
+    Circle(const Vector c, const float r) : center(c), radius(r) {}
+
+    [[nodiscard]] bool contains(const Vector p) const {
+        return glm::distance2(center, p) < radius * radius;
+    }
+
+    // The square around the circle.
+    [[nodiscard]] Rectangle bound() const {
+        return {center, Vector {radius}};
+    }
+
+    Vector center{0, 0};
+    float radius = 0.0f;
+};
+
 std::ostream& operator<<(std::ostream& os, Rectangle const& r) {
     os << "Rectangle(center: {"
     << r.center.x << ", " << r.center.y
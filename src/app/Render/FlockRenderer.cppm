@@ -3,9 +3,14 @@ module;
 export module FlockRenderer;
 
 import Boid;
+import BoidStore;
 import Camera;
+import Profiler;
 import RawArray;
 
+const ProfileZone FlockRendererUpdateZone {"FlockRenderer::update"};
+const ProfileZone FlockRendererDrawZone {"FlockRenderer::draw"};
+
 
 export class Object {
 public:
@@ -170,11 +175,14 @@ public:
     int16_t attribute = 0;
 };
 
-export void attachBoidData(Model *model, lwvl::Buffer& buffer) {
-    model->layout.array(buffer, 1, 0, sizeof(Boid));
-    model->layout.attribute(1, 1, Vector::length(), lwvl::ByteFormat::Float, offsetof(Boid, position));
-    model->layout.attribute(1, 2, Vector::length(), lwvl::ByteFormat::Float, offsetof(Boid, velocity));
-    model->layout.divisor(1, 1);
+// The buffer holds a BoidStore as is. Each of x, y, vx and vy gets its own binding and attribute, locations 1 to 4.
+export void attachBoidData(Model *model, lwvl::Buffer& buffer, const size_t stride) {
+    for (size_t component = 0; component < BoidStore::ComponentCount; ++component) {
+        const auto binding = static_cast<uint32_t>(component + 1);
+        model->layout.array(buffer, binding, component * stride * sizeof(float), sizeof(float));
+        model->layout.attribute(binding, binding, 1, lwvl::ByteFormat::Float, 0);
+        model->layout.divisor(binding, 1);
+    }
 }
 
 
@@ -276,27 +284,37 @@ private:
 
 export class FlockRenderer {
 public:
-    explicit FlockRenderer(size_t size) : flockSize(size) {
-        data.store<float>(nullptr, size * sizeof(Boid), lwvl::bits::Dynamic | lwvl::bits::Client);
+    explicit FlockRenderer(size_t size) : flockSize(size), stride(BoidStore::stride_for(size)) {
+        data.store<float>(nullptr, bytes(), lwvl::bits::Dynamic | lwvl::bits::Client);
     }
 
-    void update(Boid const array[]) {
-        data.update(array, flockSize * sizeof(Boid));
+    // Uploads the whole store, padding included, in one call.
+    void update(BoidStore const &boids) {
+        ProfileScope profile {FlockRendererUpdateZone};
+        data.update(boids.data(), std::min(boids.bytes(), bytes()));
     }
 
+    // Models have to be attached again afterwards, the array offsets depend on the size.
     void resize(size_t size) {
-        data.store<float>(nullptr, size * sizeof(Boid), lwvl::bits::Dynamic | lwvl::bits::Client);
         flockSize = size;
+        stride = BoidStore::stride_for(size);
+        data.store<float>(nullptr, bytes(), lwvl::bits::Dynamic | lwvl::bits::Client);
     }
 
     void attachData(Model *model) {
-        attachBoidData(model, data);
+        attachBoidData(model, data, stride);
     }
 
     static void draw(Model const *model, BoidShader const *shader) {
+        ProfileScope profile {FlockRendererDrawZone};
         shader->draw(model);
     }
 private:
+    [[nodiscard]] size_t bytes() const {
+        return BoidStore::ComponentCount * stride * sizeof(float);
+    }
+
     lwvl::Buffer data;
     size_t flockSize;
+    size_t stride;
 };
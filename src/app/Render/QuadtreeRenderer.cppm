@@ -5,6 +5,11 @@ export module QuadtreeRenderer;
 import Quadtree;
 import QuadtreeGeometry;
 import Camera;
+import Profiler;
+
+// Inline so the update template can name it from importing translation units.
+inline const ProfileZone QuadtreeRendererUpdateZone {"QuadtreeRenderer::update"};
+inline const ProfileZone QuadtreeRendererDrawZone {"QuadtreeRenderer::draw"};
 
 glm::vec4 lch_to_lab(glm::vec4 color) {
     const float a = glm::cos(glm::radians(color.b)) * color.g;
@@ -177,14 +182,15 @@ public:
         m_color_control.uniform("projection").matrix4F(&proj[0][0]);
     }
 
-    template<class T>
-    void update(Quadtree<T> const &tree) {
+    template<class Tree>
+    void update(Tree const &tree) {
+        ProfileScope profile {QuadtreeRendererUpdateZone};
         const int nodes = static_cast<int>(tree.size());
         const int vertex_count = nodes * static_cast<int>(QuadtreeNodeVertexCount);
         m_primitive_count = nodes * 2;
         m_vertex_data.resize(vertex_count);
         {
-            QuadtreeGeometry<T> geometry {tree};
+            QuadtreeGeometry<Tree> geometry {tree};
             geometry(m_vertex_data.data());
         }
 
@@ -215,6 +221,7 @@ public:
     }
 
     void draw(const bool draw_colors, const bool draw_lines) const {
+        ProfileScope profile {QuadtreeRendererDrawZone};
         //m_control.draw(this, [](const void* user_ptr){
         //    const auto* renderer = static_cast<const QuadtreeRenderer*>(user_ptr);
         //    renderer->m_layout.drawElements(lwvl::PrimitiveMode::Triangles, renderer->m_primitiveCount * 3, lwvl::ByteFormat::UnsignedInt);
@@ -4,6 +4,10 @@ export module RectangleRenderer;
 
 import Rectangle;
 import Camera;
+import Profiler;
+
+const ProfileZone RectangleRendererUpdateZone {"RectangleRenderer::update"};
+const ProfileZone RectangleRendererDrawZone {"RectangleRenderer::draw"};
 
 
 export class RectangleRenderer;
@@ -115,6 +119,7 @@ public:
     }
 
     void update() const {
+        ProfileScope profile {RectangleRendererUpdateZone};
         const auto count = m_data.size();
         const auto buffer_size = static_cast<SignedInt>(count * sizeof(RectangleInstance));
         if (buffer_size > m_buffer_size) {
@@ -142,6 +147,7 @@ public:
     }
 
     void draw() const {
+        ProfileScope profile {RectangleRendererDrawZone};
         m_control.bind();
         m_layout.drawArrays(lwvl::PrimitiveMode::LineLoop, 4);
         lwvl::Program::clear();
@@ -0,0 +1,92 @@
+module;
+#include "pch.hpp"
+export module Morton;
+
+import Rectangle;
+
+
+// Z-order (Morton) codes: the bits of x and y interleaved, so points close in space tend to be close in code order.
+// Sorting by code is how the flock and the tree builders get spatially local memory order.
+
+
+// Spreads the low 16 bits of v out to the even bits.
+constexpr uint32_t spread_bits(uint32_t v) {
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+export constexpr uint32_t morton_code(const uint32_t x, const uint32_t y) {
+    return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+
+// Maps positions inside a box onto a 65536 x 65536 lattice and returns their codes.
+// Positions outside the box are clamped to its edge. Positions that quantize to NaN land in cell 0.
+export class MortonQuantizer {
+public:
+    static constexpr float Cells = 65535.0f;
+
+    MortonQuantizer(const Vector low, const Vector high) : m_low(low) {
+        const Vector extent = glm::max(high - low, Vector {std::numeric_limits<float>::min()});
+        m_scale = Cells / extent;
+    }
+
+    explicit MortonQuantizer(Rectangle const &box) : MortonQuantizer(box.center - box.size, box.center + box.size) {}
+
+    [[nodiscard]] uint32_t operator()(const float x, const float y) const {
+        return morton_code(cell((x - m_low.x) * m_scale.x), cell((y - m_low.y) * m_scale.y));
+    }
+
+private:
+    // Converting NaN to an integer is undefined, and std::clamp passes NaN through. NaN fails the test and maps to 0.
+    static uint32_t cell(const float position) {
+        return position > 0.0f ? static_cast<uint32_t>(std::min(position, Cells)) : 0;
+    }
+
+    Vector m_low;
+    Vector m_scale;
+};
+
+
+// Least-significant-digit radix sort of keys, carrying values along. Stable, 8 bits per pass.
+// Passes where every key has the same digit are skipped. The scratch vectors are resized as needed and can be
+//   kept between calls to avoid allocating.
+export void radix_sort(
+    std::vector<uint32_t> &keys, std::vector<uint32_t> &values,
+    std::vector<uint32_t> &key_scratch, std::vector<uint32_t> &value_scratch
+) {
+    const size_t count = keys.size();
+    key_scratch.resize(count);
+    value_scratch.resize(count);
+
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        std::array<uint32_t, 256> offsets {};
+        for (const uint32_t key: keys) {
+            ++offsets[(key >> shift) & 0xFF];
+        }
+
+        if (count == 0 || offsets[(keys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+
+        uint32_t total = 0;
+        for (uint32_t &offset: offsets) {
+            const uint32_t digits = offset;
+            offset = total;
+            total += digits;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t slot = offsets[(keys[i] >> shift) & 0xFF]++;
+            key_scratch[slot] = keys[i];
+            value_scratch[slot] = values[i];
+        }
+
+        keys.swap(key_scratch);
+        values.swap(value_scratch);
+    }
+}
@@ -1,17 +1,21 @@
 module;
 #include "pch.hpp"
+#include <bit>
+#include <numeric>
+#include <stdexcept>
 export module Quadtree;
 
+import Morton;
 import Rectangle;
 
 // ? Generational algorithm to learn which bucket size works best for a number of birds
-// ? Sort boid arrays to have boids in the same cache line as the boids they access most often
+// . Flock::reorder_every sorts boid arrays to have boids in the same cache line as the boids they access most often
 
 // C-style struct and others can define their own interactions with the data.
 // . Makes it easier to implement classes that need only a small subset of the data.
 
-// Perhaps this would be better implemented as a 2-stage structure.
-//  Two classes, one for creating the tree and one for searching the resulting tree.
+// Implemented as a 2-stage structure.
+//  Quadtree is for creating the tree, FrozenQuadtree for searching the resulting tree.
 // . Allows us to have to separate representations of the tree
 //   . Linked-list when creating the tree for ease of insertion
 //   . Harden the tree into a vector for speed of search
@@ -20,16 +24,99 @@ import Rectangle;
 export constexpr size_t QuadtreeChildCount = 4;
 export constexpr Vector QuadrantOffsets[QuadtreeChildCount] {{1.0f, 1.0f}, {-1.0f, 1.0f}, {-1.0f, -1.0f}, {1.0f, -1.0f}};
 
-export template<class T>
+
+// How the trees index their vectors on the insert and search paths.
+// CheckedAccess goes through at() and throws on a bad index. UncheckedAccess indexes directly and relies on the
+//   tree's invariants to keep the index in range. validate() checks those invariants.
+// Telling the optimizer to assume the index is in range measured slower than plain indexing, so it does not.
+export struct CheckedAccess {
+    static constexpr bool Checked = true;
+
+    template<typename Container>
+    static decltype(auto) get(Container &container, const size_t index) {
+        return container.at(index);
+    }
+};
+
+export struct UncheckedAccess {
+    static constexpr bool Checked = false;
+
+    template<typename Container>
+    static decltype(auto) get(Container &container, const size_t index) {
+        return container[index];
+    }
+};
+
+// Checked while developing, unchecked in release builds.
+#ifdef NDEBUG
+export using QuadtreeAccess = UncheckedAccess;
+#else
+export using QuadtreeAccess = CheckedAccess;
+#endif
+
+
+// Insert picks a child by comparing with the parent's center, but the child's edges are recomputed from its own
+//   center and size, so a point on a split line can sit an ulp or two outside the leaf it went into.
+bool within_rounding(Rectangle const &bound, const Vector position) {
+    const Vector slack {
+        (std::abs(bound.center.x) + bound.size.x) * 4.0f * Epsilon,
+        (std::abs(bound.center.y) + bound.size.y) * 4.0f * Epsilon
+    };
+
+    return Rectangle {bound.center, bound.size + slack}.contains(position);
+}
+
+// Bit i is set if point i of the count at xs and ys is inside area, by the same comparisons as Rectangle::contains.
+// All Lanes points are tested without branching so the compiler can turn the loop into vector compares. Lanes past
+//   count are masked off afterwards, so they only have to be readable.
+template<size_t Lanes>
+uint32_t inside_mask(Rectangle const &area, float const *xs, float const *ys, const size_t count) {
+    static_assert(Lanes < 32);
+    const float left = area.center.x - area.size.x;
+    const float right = area.center.x + area.size.x;
+    const float bottom = area.center.y - area.size.y;
+    const float top = area.center.y + area.size.y;
+
+    uint32_t mask = 0;
+    for (size_t i = 0; i < Lanes; ++i) {
+        const bool outside = (xs[i] < left) | (xs[i] > right) | (ys[i] < bottom) | (ys[i] > top);
+        mask |= static_cast<uint32_t>(!outside) << i;
+    }
+
+    return mask & ((1u << count) - 1);
+}
+
+// Same for a circle: bit i is set if point i is strictly within area's radius. The squared distance of every lane is
+//   written to d2, by the same sum as Circle::contains.
+template<size_t Lanes>
+uint32_t within_mask(Circle const &area, float const *xs, float const *ys, const size_t count, float *d2) {
+    static_assert(Lanes < 32);
+    const float radius2 = area.radius * area.radius;
+
+    uint32_t mask = 0;
+    for (size_t i = 0; i < Lanes; ++i) {
+        d2[i] = glm::distance2(area.center, Vector {xs[i], ys[i]});
+        mask |= static_cast<uint32_t>(d2[i] < radius2) << i;
+    }
+
+    return mask & ((1u << count) - 1);
+}
+
+
+export template<class T, class Access = QuadtreeAccess>
 struct Quadtree {
     static constexpr size_t BucketItemCount = 8;  // Some multiple that's cache-appropriate
     static constexpr size_t MaxDepth = 11;        // Max 32.
 
-    typedef std::array<T, BucketItemCount> Bucket;
-    typedef std::array<Vector, BucketItemCount> Points;
-    struct BucketList {
-        ptrdiff_t next = 0;
+    // Up to BucketItemCount points of a leaf, in one block so reaching a leaf touches one place in memory.
+    // Positions are split into x and y arrays so a whole bucket is tested against an area at once, and the block is
+    //   aligned so those two arrays fill one cache line. Slots past size are left as they are.
+    struct alignas(64) Bucket {
+        std::array<float, BucketItemCount> xs {};
+        std::array<float, BucketItemCount> ys {};
+        std::array<T, BucketItemCount> data {};
         size_t size = 0;
+        ptrdiff_t next = 0;  // Offset to the bucket filled before this one in the leaf's chain. 0 ends the chain.
     };
 
     struct Node {
@@ -41,112 +128,218 @@ struct Quadtree {
         }
 
         [[nodiscard]] inline bool has_children() const {
-            return children.at(0) > 0;  // Assumption: all children are allocated at the same time.
+            return Access::get(children, 0) > 0;  // Assumption: all children are allocated at the same time.
         }
     };
 
     inline void initialize() {
         nodes.emplace_back();
-        create_bucket();
-        nodes[0].bucket_index = 0;
+        nodes[0].bucket_index = create_bucket();
     }
 
-    inline void create_child(size_t node, size_t child, const ptrdiff_t bucket) {
-        const size_t new_node_index = nodes.size();
-        nodes.emplace_back();
-        nodes[node][child] = new_node_index;
-        nodes[new_node_index].bucket_index = bucket;
+    // Children are allocated as a group of QuadtreeChildCount consecutive nodes, reusing a merged group if possible.
+    // The first child takes over the parent's bucket.
+    inline void create_children(const size_t node, const ptrdiff_t bucket) {
+        size_t first = nodes.size();
+        if (free_children.empty()) {
+            nodes.resize(first + QuadtreeChildCount);
+        } else {
+            first = free_children.back();
+            free_children.pop_back();
+        }
+
+        for (size_t i = 0; i < QuadtreeChildCount; ++i) {
+            nodes[first + i] = Node {};
+            nodes[first + i].bucket_index = i == 0 ? bucket : create_bucket();
+            nodes[node][i] = first + i;
+        }
     }
 
-    inline void create_bucket() {
-        lists.emplace_back();
+    inline ptrdiff_t create_bucket() {
+        if (!free_buckets.empty()) {
+            const ptrdiff_t bucket = free_buckets.back();
+            free_buckets.pop_back();
+            buckets[bucket] = Bucket {};
+            return bucket;
+        }
+
         buckets.emplace_back();
-        points.emplace_back();
+        return static_cast<ptrdiff_t>(buckets.size()) - 1;
     }
 
     inline void add(int point, T data, Vector position) {
-        const int point_count = lists[point].size++;
-        buckets[point][point_count] = data;
-        points[point][point_count] = position;
+        Bucket &bucket = buckets[point];
+        const size_t slot = bucket.size++;
+        bucket.xs[slot] = position.x;
+        bucket.ys[slot] = position.y;
+        bucket.data[slot] = data;
     }
 
     inline void new_linked_bucket(ptrdiff_t node) {
         // Create a new bucket
         // Set that bucket as the node's bucket
-        // Have the BucketList point backwards to the previous bucket
-        const ptrdiff_t new_bucket_index = buckets.size();
-        create_bucket();
-        lists[new_bucket_index].next = nodes[node].bucket_index - new_bucket_index;
+        // Have the new bucket point backwards to the previous bucket
+        const ptrdiff_t new_bucket_index = create_bucket();
+        buckets[new_bucket_index].next = nodes[node].bucket_index - new_bucket_index;
         nodes[node].bucket_index = new_bucket_index;
     }
 
     void subdivide(const size_t node, const ptrdiff_t bucket, Rectangle bound) {
-        create_child(node, 0, bucket);
-        for(size_t i = 1; i < QuadtreeChildCount; ++i) {
-            create_child(node, i, buckets.size());
-            create_bucket();
-        }
+        create_children(node, bucket);
 
-        Bucket current_bucket{buckets[bucket]};
-        Points current_points{points[bucket]};
-        lists[bucket].size = 0;
+        const Bucket current_bucket{buckets[bucket]};
+        buckets[bucket].size = 0;
 
         for(size_t i = 0; i < BucketItemCount; ++i) {
-            const Vector point_position = current_points[i];
+            const Vector point_position {current_bucket.xs[i], current_bucket.ys[i]};
             const int quadrant = bound.quadrant(point_position);
-            add(node_bucket(node_child(node, quadrant)), current_bucket[i], point_position);
+            add(node_bucket(node_child(node, quadrant)), current_bucket.data[i], point_position);
         }
 
         nodes[node].bucket_index = -1;
     }
 
-    void push(const Rectangle area, const size_t node, std::vector<T> &search_results) const {
-        if (node_bucket(node) > -1 && bucket_size(node_bucket(node)) > 0) {
-            ptrdiff_t index = node_bucket(node);
-            BucketList const *list = &lists.at(index);
-            while(true) {
-                for (size_t i = 0; i < list->size; ++i) {
-                    if (area.contains(position(index, i))) {
-                        search_results.push_back(data(index, i));
-                    }
-                }
+    // Calls visitor(xs, ys, data, count) for each bucket of a leaf, following its chain from the head.
+    // The arrays are BucketItemCount long, whatever count is.
+    template<typename Visitor>
+    void for_each_bucket(const size_t node, Visitor &&visitor) const {
+        ptrdiff_t index = node_bucket(node);
+        while (index > -1) {
+            Bucket const &bucket = Access::get(buckets, index);
+            visitor(bucket.xs.data(), bucket.ys.data(), bucket.data.data(), bucket.size);
+            if (bucket.next == 0) {
+                break;
+            }
 
-                if (list->next == 0) {
-                    break;
-                }
+            index += bucket.next;
+        }
+    }
 
-                index += list->next;
-                list = &lists.at(index);
+    // Calls visitor(data, position) for every point of a leaf inside area, following its bucket chain.
+    template<typename Visitor>
+    void for_each_in_leaf(const Rectangle area, const size_t node, Visitor &&visitor) const {
+        for_each_bucket(node, [&area, &visitor](float const *xs, float const *ys, T const *data, const size_t count) {
+            for (uint32_t inside = inside_mask<BucketItemCount>(area, xs, ys, count); inside; inside &= inside - 1) {
+                const int i = std::countr_zero(inside);
+                visitor(data[i], Vector {xs[i], ys[i]});
             }
-        }
+        });
+    }
+
+    // Calls visitor(data, position, d2) for every point of a leaf within area's radius, with its squared distance.
+    template<typename Visitor>
+    void for_each_in_leaf(const Circle area, const size_t node, Visitor &&visitor) const {
+        for_each_bucket(node, [&area, &visitor](float const *xs, float const *ys, T const *data, const size_t count) {
+            float d2[BucketItemCount];
+            uint32_t inside = within_mask<BucketItemCount>(area, xs, ys, count, d2);
+            for (; inside; inside &= inside - 1) {
+                const int i = std::countr_zero(inside);
+                visitor(data[i], Vector {xs[i], ys[i]}, d2[i]);
+            }
+        });
+    }
+
+    void push(const Rectangle area, const size_t node, std::vector<T> &search_results) const {
+        for_each_in_leaf(area, node, [&search_results](const T data, Vector) {
+            search_results.push_back(data);
+        });
     }
 
     [[nodiscard]] inline bool node_has_children(size_t node) const {
-        return nodes.at(node).has_children();
+        return Access::get(nodes, node).has_children();
     }
 
     [[nodiscard]] inline size_t node_child(size_t node, size_t child) const {
-        return nodes.at(node).children.at(child);
+        return Access::get(Access::get(nodes, node).children, child);
     }
 
     [[nodiscard]] inline ptrdiff_t node_bucket(size_t node) const {
-        return nodes.at(node).bucket_index;
+        return Access::get(nodes, node).bucket_index;
     }
 
     [[nodiscard]] inline size_t bucket_size(size_t bucket) const {
-        return lists.at(bucket).size;
+        return Access::get(buckets, bucket).size;
+    }
+
+    // Points in a leaf, across its whole bucket chain.
+    [[nodiscard]] size_t leaf_size(size_t node) const {
+        size_t total = 0;
+        for_each_bucket(node, [&total](float const *, float const *, T const *, const size_t count) {
+            total += count;
+        });
+
+        return total;
     }
 
     [[nodiscard]] inline T data(size_t bucket, size_t index) const {
-        return buckets.at(bucket).at(index);
+        return Access::get(Access::get(buckets, bucket).data, index);
     }
 
-    [[nodiscard]] inline Vector position(size_t point_list, size_t index) const {
-        return points.at(point_list).at(index);
+    [[nodiscard]] inline Vector position(size_t bucket, size_t index) const {
+        Bucket const &block = Access::get(buckets, bucket);
+        return {Access::get(block.xs, index), Access::get(block.ys, index)};
     }
 
+    // Nodes in the tree, not counting groups freed by merges.
     [[nodiscard]] inline size_t size() const {
-        return nodes.size();
+        return nodes.size() - free_children.size() * QuadtreeChildCount;
+    }
+
+    // Shape of the tree. Dense clusters push leaves to MaxDepth, where they overflow into linked bucket chains.
+    struct Statistics {
+        size_t nodes = 0;
+        size_t leaves = 0;
+        size_t items = 0;
+        size_t buckets = 0;
+        std::array<size_t, MaxDepth + 1> leaves_per_depth {};
+        std::array<size_t, BucketItemCount + 1> bucket_fill {};  // Number of buckets holding 0 to BucketItemCount items.
+        size_t chained_leaves = 0;  // Leaves with more than one bucket.
+        size_t longest_chain = 0;   // Buckets in the longest Bucket::next chain.
+        double average_chain = 0.0;
+        size_t wasted_slots = 0;    // Unused slots across every Bucket.
+        size_t wasted_bytes = 0;
+    };
+
+    // Walks the whole tree. For diagnostics; costs about as much as a search over every leaf.
+    [[nodiscard]] Statistics statistics() const {
+        Statistics result;
+        result.nodes = size();
+        result.buckets = buckets.size() - free_buckets.size();
+
+        size_t chain_total = 0;
+        std::vector<std::pair<size_t, size_t>> stack {{0, 0}};  // Node, depth
+        while (!stack.empty()) {
+            const auto [node, depth] = stack.back();
+            stack.pop_back();
+            if (node_has_children(node)) {
+                for (const size_t child: nodes.at(node).children) {
+                    stack.emplace_back(child, depth + 1);
+                }
+                continue;
+            }
+
+            ++result.leaves;
+            ++result.leaves_per_depth.at(depth);
+
+            size_t chain = 0;
+            for_each_bucket(node, [&result, &chain](float const *, float const *, T const *, const size_t count) {
+                ++chain;
+                ++result.bucket_fill.at(count);
+                result.items += count;
+            });
+
+            chain_total += chain;
+            result.longest_chain = std::max(result.longest_chain, chain);
+            result.chained_leaves += chain > 1;
+        }
+
+        if (result.leaves > 0) {
+            result.average_chain = static_cast<double>(chain_total) / static_cast<double>(result.leaves);
+        }
+
+        result.wasted_slots = result.buckets * BucketItemCount - result.items;
+        result.wasted_bytes = result.wasted_slots * (sizeof(T) + sizeof(Vector));
+        return result;
     }
 
     explicit Quadtree(Rectangle bounding_box) : bounds(bounding_box) {
@@ -154,10 +347,10 @@ struct Quadtree {
     }
 
     void clear() {
-        lists.clear();
         buckets.clear();
-        points.clear();
         nodes.clear();
+        free_buckets.clear();
+        free_children.clear();
 
         initialize();
     }
@@ -201,70 +394,852 @@ struct Quadtree {
         }
     }
 
+    // Depth-first walk over the tree in quadrant order, with no allocation.
+    // Calls visitor(node, depth, bound) on every node it reaches, the root included, and only descends into the
+    //   children of nodes the visitor returns true for. The visitor is a template parameter so it is inlined.
+    template<typename Visitor>
+    void for_each_node(Visitor &&visitor) const {
+        // Array of rectangles with a very specific structure.
+        Rectangle terrace[MaxDepth + 1];
+        terrace[0] = Rectangle{bounds};
+        if (!visitor(size_t{0}, size_t{0}, terrace[0]) || !node_has_children(0)) {
+            return;
+        }
+
+        size_t indices[MaxDepth + 1];
+        indices[0] = 0;
+        indices[1] = node_child(0, 0);
+
+        // Array of 32 2-bit numbers. Saves the search quadrant of the current level when descending.
+        uint64_t quadrant_memory = 0;
+        size_t depth = 1;
+        bool ascended = false;
+
+        while (true) {
+            // The last 2 bits of the state are the current quadrant
+            uint8_t quadrant = quadrant_memory & 0b11;
+            const size_t node_index = indices[depth];
+
+            // Critical operations happen when descending the tree
+            if (!ascended) {
+                Rectangle new_bound{terrace[depth - 1]};
+                new_bound.size = new_bound.size * 0.5f;
+                new_bound.center = new_bound.center + new_bound.size * QuadrantOffsets[quadrant];
+                terrace[depth] = new_bound;
+
+                if (visitor(node_index, depth, new_bound) && node_has_children(node_index)) {
+                    indices[++depth] = node_child(node_index, 0);
+                    // Shift left 2 bits to go down
+                    quadrant_memory <<= 2;
+                    continue;
+                }
+            }
+
+            ++quadrant;
+
+            if (quadrant >= QuadtreeChildCount) {
+                // Shift right 2 bits to go up
+                quadrant_memory >>= 2;
+                ascended = true;
+                --depth;
+
+                if (!depth) {
+                    break;
+                }
+            } else {
+                indices[depth] = node_child(indices[depth - 1], quadrant);
+                quadrant_memory += 1;
+                ascended = false;
+            }
+        }
+    }
+
+    // Calls visitor(data, position) for every point inside area, straight from the leaf buckets.
+    template<typename Visitor>
+    void for_each_in_range(const Rectangle area, Visitor &&visitor) const {
+        for_each_node([this, &area, &visitor](const size_t node, size_t, Rectangle const &bound) {
+            if (!bound.intersects(area)) {
+                return false;
+            }
+
+            if (!node_has_children(node)) {
+                // Bottom. Add my contents to the search.
+                for_each_in_leaf(area, node, visitor);
+            }
+
+            return true;
+        });
+    }
+
+    // Calls visitor(data, position, d2) for every point strictly within area's radius.
+    // Nodes are culled by the circle's bounding square. Culling by distance from the center skips a few more corner
+    //   leaves but measured slower: the points of those leaves are rejected a bucket at a time for less than the test.
+    template<typename Visitor>
+    void for_each_in_radius(const Circle area, Visitor &&visitor) const {
+        const Rectangle square {area.bound()};
+        for_each_node([this, &area, &square, &visitor](const size_t node, size_t, Rectangle const &bound) {
+            if (!bound.intersects(square)) {
+                return false;
+            }
+
+            if (!node_has_children(node)) {
+                for_each_in_leaf(area, node, visitor);
+            }
+
+            return true;
+        });
+    }
+
     // Default search for T
     void search(Rectangle area, std::vector<T> &search_results) const {
-        if (bounds.intersects(area)) {
-            int32_t indices[MaxDepth + 1];
-            indices[0] = 0;
-            indices[1] = node_child(0, 0);
-
-            // Array of rectangles with a very specific structure.
-            Rectangle terrace[MaxDepth + 1];  // TODO: test storing just centers
-            terrace[0] = Rectangle{bounds};
-            if (indices[1] == 0) { return; }
-
-            // Array of 32 2-bit numbers. Saves the search quadrant of the current level when descending.
-            uint64_t quadrant_memory = 0;
-            int depth = 1;
-            bool ascended = false;
-
-            // Possible to abstract this loop?
-            while (true) {
-                // The last 2 bits of the state are the current quadrant
-                uint8_t quadrant = quadrant_memory & 0b11;
-                const size_t node_index = indices[depth];
-
-                // Critical operations happen when descending the tree
-                if (!ascended) {
-                    Rectangle new_bound{terrace[depth - 1]};
-                    new_bound.size = new_bound.size * 0.5f;
-                    new_bound.center = new_bound.center + new_bound.size * QuadrantOffsets[quadrant];
-                    terrace[depth] = new_bound;
-
-                    if (node_has_children(node_index) && new_bound.intersects(area)) {
-                        indices[++depth] = node_child(node_index, 0);
-                        // Shift left 2 bits to go down
-                        quadrant_memory <<= 2;
-                        continue;
-                    } else if (new_bound.intersects(area)) {
-                        // Bottom. Add my contents to the search.
-                        push(area, node_index, search_results);
-                    }
+        for_each_in_range(area, [&search_results](const T data, Vector) {
+            search_results.push_back(data);
+        });
+    }
+
+    void search(Circle area, std::vector<T> &search_results) const {
+        for_each_in_radius(area, [&search_results](const T data, Vector, float) {
+            search_results.push_back(data);
+        });
+    }
+
+    // Checks the invariants the unchecked accessors rely on, and throws std::logic_error naming the first one broken:
+    //   every node is reached exactly once, internal nodes have no bucket and leaves no children, bucket chains only
+    //   hang off MaxDepth leaves and are full behind the head, every index is in range, free lists account for the
+    //   rest of the storage, and points lie in their leaf. Returns the number of points. Costs a full walk.
+    size_t validate() const {
+        const auto fail = [](const char *what) {
+            throw std::logic_error(std::string {"Quadtree::validate: "} + what);
+        };
+
+        if (nodes.empty()) {
+            fail("no root");
+        }
+
+        std::vector<bool> node_seen(nodes.size()), bucket_seen(buckets.size());
+        size_t items = 0;
+        size_t reached = 0;
+        size_t buckets_used = 0;
+
+        struct Entry {
+            size_t node;
+            size_t depth;
+            Rectangle bound;
+        };
+
+        std::vector<Entry> stack {{0, 0, Rectangle {bounds}}};
+        while (!stack.empty()) {
+            const Entry entry = stack.back();
+            stack.pop_back();
+            if (entry.node >= nodes.size() || node_seen[entry.node]) {
+                fail("node out of range or reached twice");
+            }
+
+            node_seen[entry.node] = true;
+            ++reached;
+            Node const &node = nodes[entry.node];
+            if (node.has_children()) {
+                if (node.bucket_index != -1 || entry.depth >= MaxDepth) {
+                    fail("internal node with a bucket or below MaxDepth");
+                }
+
+                for (size_t quadrant = 0; quadrant < QuadtreeChildCount; ++quadrant) {
+                    Rectangle child {entry.bound};
+                    child.size = child.size * 0.5f;
+                    child.center = child.center + child.size * QuadrantOffsets[quadrant];
+                    stack.push_back({node.children[quadrant], entry.depth + 1, child});
                 }
 
-                ++quadrant;
+                continue;
+            }
 
-                if (quadrant >= QuadtreeChildCount) {
-                    // Shift right 2 bits to go up
-                    quadrant_memory >>= 2;
-                    ascended = true;
-                    --depth;
+            ptrdiff_t index = node.bucket_index;
+            for (size_t chain = 0; ; ++chain) {
+                if (index < 0 || static_cast<size_t>(index) >= buckets.size() || bucket_seen[index]) {
+                    fail("bucket out of range or shared");
+                }
+
+                bucket_seen[index] = true;
+                ++buckets_used;
+                Bucket const &bucket = buckets[index];
+                if (bucket.size > BucketItemCount || (chain > 0 && bucket.size != BucketItemCount)) {
+                    fail("overfull bucket, or a partly full bucket behind the head of a chain");
+                }
 
-                    if (!depth) {
-                        break;
+                for (size_t i = 0; i < bucket.size; ++i) {
+                    if (!within_rounding(entry.bound, Vector {bucket.xs[i], bucket.ys[i]})) {
+                        fail("point outside its leaf");
                     }
+                }
+
+                items += bucket.size;
+                if (bucket.next == 0) {
+                    break;
+                }
+
+                if (entry.depth != MaxDepth) {
+                    fail("bucket chain above MaxDepth");
+                }
+
+                index += bucket.next;
+            }
+        }
+
+        if (reached + free_children.size() * QuadtreeChildCount != nodes.size()) {
+            fail("nodes neither reachable nor free");
+        }
+
+        if (buckets_used + free_buckets.size() != buckets.size()) {
+            fail("buckets neither reachable nor free");
+        }
+
+        return items;
+    }
+
+    // Moves every point to position_of(data) without rebuilding the tree.
+    // Points still inside their leaf are updated in place. The rest are taken out and inserted again, splitting
+    //   leaves that overflow. Sibling leaves left with at most half a bucket between them merge into their parent;
+    //   the gap between that and a full bucket keeps a leaf from splitting and merging on alternate updates.
+    // Every point is read once, but only points that changed leaves descend from the root.
+    // Returns false if a point left the root bounds and was dropped. Clear and insert everything again then.
+    template<typename PositionOf>
+    bool relocate(PositionOf &&position_of) {
+        relocated.clear();
+        relocate_node(0, Rectangle {bounds}, position_of);
+
+        bool inside = true;
+        for (const T data: relocated) {
+            inside &= insert(data, position_of(data));
+        }
+
+        return inside;
+    }
+
+    template<typename PositionOf>
+    void relocate_node(const size_t node, Rectangle const &bound, PositionOf &position_of) {
+        if (!node_has_children(node)) {
+            relocate_leaf(node, bound, position_of);
+            return;
+        }
+
+        bool mergeable = true;
+        size_t points_below = 0;
+        for (size_t quadrant = 0; quadrant < QuadtreeChildCount; ++quadrant) {
+            Rectangle child_bound {bound};
+            child_bound.size = child_bound.size * 0.5f;
+            child_bound.center = child_bound.center + child_bound.size * QuadrantOffsets[quadrant];
+
+            const size_t child = node_child(node, quadrant);
+            relocate_node(child, child_bound, position_of);
+            if (node_has_children(child) || buckets[node_bucket(child)].next != 0) {
+                mergeable = false;
+            } else {
+                points_below += bucket_size(node_bucket(child));
+            }
+        }
+
+        if (mergeable && points_below <= BucketItemCount / 2) {
+            merge_children(node);
+        }
+    }
+
+    template<typename PositionOf>
+    void relocate_leaf(const size_t node, Rectangle const &bound, PositionOf &position_of) {
+        ptrdiff_t index = node_bucket(node);
+        while (true) {
+            Bucket &bucket = buckets[index];
+            size_t i = 0;
+            while (i < bucket.size) {
+                const T data = bucket.data[i];
+                const Vector position = position_of(data);
+                if (bound.contains(position)) {
+                    bucket.xs[i] = position.x;
+                    bucket.ys[i++] = position.y;
                 } else {
-                    indices[depth] = node_child(indices[depth - 1], quadrant);
-                    quadrant_memory += 1;
-                    ascended = false;
+                    // The slot is refilled from the head bucket, so look at it again.
+                    relocated.push_back(data);
+                    remove(node, index, i);
                 }
             }
+
+            // A released head keeps its link until the bucket is reused, which only happens after the walk.
+            const ptrdiff_t next = bucket.next;
+            if (next == 0) {
+                break;
+            }
+
+            index += next;
         }
     }
 
+    // Fills a slot of a leaf's chain with the newest point of the chain, dropping the head bucket once it empties.
+    // Only the head bucket of a chain is ever partly full.
+    void remove(const size_t node, const ptrdiff_t bucket, const size_t slot) {
+        const ptrdiff_t head = nodes[node].bucket_index;
+        Bucket &from = buckets[head];
+        Bucket &to = buckets[bucket];
+        const size_t last = --from.size;
+        to.xs[slot] = from.xs[last];
+        to.ys[slot] = from.ys[last];
+        to.data[slot] = from.data[last];
+
+        if (from.size == 0 && from.next != 0) {
+            nodes[node].bucket_index = head + from.next;
+            free_buckets.push_back(head);
+        }
+    }
+
+    // Turns a node whose children are single-bucket leaves back into a leaf, keeping the first child's bucket.
+    void merge_children(const size_t node) {
+        const size_t first = node_child(node, 0);
+        const ptrdiff_t bucket = node_bucket(first);
+        for (size_t i = 1; i < QuadtreeChildCount; ++i) {
+            const ptrdiff_t from = node_bucket(node_child(node, i));
+            for (size_t j = 0; j < buckets[from].size; ++j) {
+                add(static_cast<int>(bucket), buckets[from].data[j], position(from, j));
+            }
+
+            free_buckets.push_back(from);
+        }
+
+        free_children.push_back(first);
+        nodes[node] = Node {};
+        nodes[node].bucket_index = bucket;
+    }
+
     Rectangle bounds;
-    std::vector<BucketList> lists;
     std::vector<Bucket> buckets;
-    std::vector<Points> points;
     std::vector<Node> nodes;
+
+    // Buckets and sibling groups given back by relocate, reused before the vectors grow.
+    std::vector<ptrdiff_t> free_buckets;
+    std::vector<size_t> free_children;  // First node of each group.
+    std::vector<T> relocated;           // Points that changed leaves in the last relocate.
+};
+
+
+// Read-only copy of a Quadtree for searching, made by freeze after the tree is built, or built directly by bulk_load.
+// The four children of a node are stored consecutively, so they are found from one index. freeze lays the nodes out
+//   breadth first; bulk_load does not, and nothing else may assume an order across groups.
+// Each leaf's points are one contiguous run of the xs, ys and data arrays, with no bucket chains.
+//   Runs are laid out in depth-first leaf order, so leaves searched together sit close together.
+//   The arrays run BucketItemCount entries past the last point, so a whole bucket can be loaded from any run.
+// Searches visit nodes and points in the same order as on the Quadtree it was frozen from, so they return the same
+//   results in the same order.
+export template<class T, class Access = QuadtreeAccess>
+struct FrozenQuadtree {
+    using Builder = Quadtree<T, Access>;
+    static constexpr size_t BucketItemCount = Builder::BucketItemCount;
+    static constexpr size_t MaxDepth = Builder::MaxDepth;
+    static constexpr uint32_t Internal = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t Outside = std::numeric_limits<uint32_t>::max();  // Key of points outside the bounds.
+    static_assert(2 * MaxDepth < 32, "Path keys hold two bits per level.");
+
+    using Statistics = typename Builder::Statistics;
+
+    struct Node {
+        uint32_t first = 0;         // First child of an internal node, first point of a leaf.
+        uint32_t count = Internal;  // Points in a leaf. Internal for nodes with children.
+    };
+
+    // Copies tree into this layout, reusing the storage of the last freeze.
+    void freeze(Builder const &tree) {
+        bounds = tree.bounds;
+        nodes.clear();
+        xs.clear();
+        ys.clear();
+        data.clear();
+        sources.clear();
+        frozen_index.resize(tree.nodes.size());
+
+        // The node array doubles as the breadth-first queue. sources holds the tree node behind each entry.
+        nodes.emplace_back();
+        sources.push_back(0);
+        for (size_t i = 0; i < sources.size(); ++i) {
+            const size_t source = sources[i];
+            frozen_index[source] = static_cast<uint32_t>(i);
+            if (tree.node_has_children(source)) {
+                nodes[i].first = static_cast<uint32_t>(nodes.size());
+                for (size_t child = 0; child < QuadtreeChildCount; ++child) {
+                    nodes.emplace_back();
+                    sources.push_back(tree.node_child(source, child));
+                }
+            }
+        }
+
+        tree.for_each_node([this, &tree](const size_t source, size_t, Rectangle const &) {
+            if (tree.node_has_children(source)) {
+                return true;
+            }
+
+            Node &leaf = nodes[frozen_index[source]];
+            leaf.first = static_cast<uint32_t>(data.size());
+
+            // Same order as Quadtree::for_each_in_leaf: the head bucket, then back along the chain.
+            tree.for_each_bucket(source, [this](float const *x, float const *y, T const *items, const size_t count) {
+                xs.insert(xs.end(), x, x + count);
+                ys.insert(ys.end(), y, y + count);
+                data.insert(data.end(), items, items + count);
+            });
+
+            leaf.count = static_cast<uint32_t>(data.size()) - leaf.first;
+            return true;
+        });
+
+        xs.resize(xs.size() + BucketItemCount);
+        ys.resize(ys.size() + BucketItemCount);
+        data.resize(data.size() + BucketItemCount);
+    }
+
+    // Path keys of points begin to end: the quadrants each falls in on the way from bound down to MaxDepth, two bits
+    //   per level with the root's first, or Outside. Sorting by path puts the points of every node in one run, with
+    //   leaves in depth-first order.
+    // Same comparisons and the same float sums as Quadtree::insert, so a point lands in the same node either way.
+    // Points go through a block at a time with the levels as the outer loop, so the chains of compares of different
+    //   points overlap instead of each waiting on the last.
+    template<typename PositionOf>
+    static void path_keys(
+        Rectangle const &bound, PositionOf const &position_of, const size_t begin, const size_t end, uint32_t *keys
+    ) {
+        constexpr size_t Block = 16;
+        std::array<Vector, MaxDepth> sizes;
+        Vector size = bound.size;
+        for (Vector &level: sizes) {
+            size = size * 0.5f;
+            level = size;
+        }
+
+        for (size_t first = begin; first < end; first += Block) {
+            const size_t lanes = std::min(Block, end - first);
+            float x[Block], y[Block], center_x[Block], center_y[Block];
+            uint32_t key[Block];
+            for (size_t lane = 0; lane < Block; ++lane) {
+                const Vector position = lane < lanes ? position_of(first + lane) : bound.center;
+                x[lane] = position.x;
+                y[lane] = position.y;
+                center_x[lane] = bound.center.x;
+                center_y[lane] = bound.center.y;
+                key[lane] = 0;
+            }
+
+            for (Vector const &level: sizes) {
+                for (size_t lane = 0; lane < Block; ++lane) {
+                    // Rectangle::quadrant, with QuadrantOffsets as the signs of the step.
+                    const bool right = x[lane] >= center_x[lane];
+                    const bool up = y[lane] >= center_y[lane];
+                    key[lane] = key[lane] << 2 | static_cast<uint32_t>(!up) << 1 | static_cast<uint32_t>(right != up);
+                    center_x[lane] += right ? level.x : -level.x;
+                    center_y[lane] += up ? level.y : -level.y;
+                }
+            }
+
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                keys[first + lane] = bound.contains(Vector {x[lane], y[lane]}) ? key[lane] : Outside;
+            }
+        }
+    }
+
+    // Builds the tree that inserting data 0 to count - 1 at position_of(i) into a Quadtree and freezing it would,
+    //   without the Quadtree. Points get path keys, are radix sorted by them, and each node is then split off its
+    //   parent's run of sorted points.
+    // for_each_slice(work) must call work(slice) once for each slice in [0, slices), from any thread, and return when
+    //   all are done. Keys and points are filled a slice at a time. The top of the tree is expanded here until there
+    //   are a few subtrees per slice, then each slice builds its share of the subtrees.
+    template<typename PositionOf, typename ForEachSlice>
+    void bulk_load(
+        Rectangle bound, const size_t count, PositionOf const &position_of,
+        const int slices, ForEachSlice const &for_each_slice
+    ) {
+        bounds = bound;
+        keys.resize(count);
+        values.resize(count);
+        for_each_slice([&](const int slice) {
+            const size_t begin = count * slice / slices;
+            const size_t end = count * (slice + 1) / slices;
+            path_keys(bounds, position_of, begin, end, keys.data());
+            std::iota(values.begin() + begin, values.begin() + end, static_cast<uint32_t>(begin));
+        });
+
+        radix_sort(keys, values, key_scratch, value_scratch);
+        const auto inside = static_cast<uint32_t>(std::lower_bound(keys.begin(), keys.end(), Outside) - keys.begin());
+
+        nodes.assign(1, Node {});
+        ranges.assign(1, Range {0, inside, 0});
+        size_t next = 0;
+        while (next < ranges.size() && ranges.size() - next < 4 * static_cast<size_t>(slices)) {
+            expand(nodes, ranges, next++);
+        }
+
+        const size_t roots = ranges.size() - next;
+        subtrees.resize(roots);
+        for_each_slice([&](const int slice) {
+            for (size_t root = slice; root < roots; root += slices) {
+                Subtree &subtree = subtrees[root];
+                subtree.nodes.assign(1, Node {});
+                subtree.ranges.assign(1, ranges[next + root]);
+                for (size_t i = 0; i < subtree.ranges.size(); ++i) {
+                    expand(subtree.nodes, subtree.ranges, i);
+                }
+            }
+        });
+
+        // Each subtree's root takes its waiting slot. The rest of it is appended after the subtrees before it.
+        subtree_bases.resize(roots);
+        size_t end = nodes.size();
+        for (size_t root = 0; root < roots; ++root) {
+            subtree_bases[root] = end;
+            end += subtrees[root].nodes.size() - 1;
+        }
+
+        nodes.resize(end);
+        for_each_slice([&](const int slice) {
+            for (size_t root = slice; root < roots; root += slices) {
+                std::vector<Node> const &local = subtrees[root].nodes;
+                const size_t base = subtree_bases[root];
+                for (size_t i = 0; i < local.size(); ++i) {
+                    Node node = local[i];
+                    if (node.count == Internal) {
+                        node.first = static_cast<uint32_t>(base + node.first - 1);
+                    }
+
+                    nodes[i == 0 ? next + root : base + i - 1] = node;
+                }
+            }
+        });
+
+        // The leaves have put their runs of values in order. Copy the points out of the flock in that order.
+        xs.resize(inside + BucketItemCount);
+        ys.resize(inside + BucketItemCount);
+        data.resize(inside + BucketItemCount);
+        for_each_slice([&](const int slice) {
+            const size_t end = inside * (slice + 1) / slices;
+            for (size_t i = inside * slice / slices; i < end; ++i) {
+                const Vector position = position_of(values[i]);
+                xs[i] = position.x;
+                ys[i] = position.y;
+                data[i] = static_cast<T>(values[i]);
+            }
+        });
+    }
+
+    [[nodiscard]] inline bool node_has_children(size_t node) const {
+        return Access::get(nodes, node).count == Internal;
+    }
+
+    [[nodiscard]] inline size_t node_child(size_t node, size_t child) const {
+        return Access::get(nodes, node).first + child;
+    }
+
+    [[nodiscard]] inline size_t leaf_size(size_t node) const {
+        return Access::get(nodes, node).count;
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return nodes.size();
+    }
+
+    // Same contract as Quadtree::for_each_bucket. A leaf's run is handed out BucketItemCount points at a time.
+    template<typename Visitor>
+    void for_each_bucket(const size_t node, Visitor &&visitor) const {
+        Node const &leaf = Access::get(nodes, node);
+        const uint32_t end = leaf.first + leaf.count;
+        for (uint32_t first = leaf.first; first < end; first += BucketItemCount) {
+            visitor(
+                xs.data() + first, ys.data() + first, data.data() + first,
+                std::min<size_t>(BucketItemCount, end - first)
+            );
+        }
+    }
+
+    // Calls visitor(data, position) for every point of a leaf inside area.
+    template<typename Visitor>
+    void for_each_in_leaf(const Rectangle area, const size_t node, Visitor &&visitor) const {
+        for_each_bucket(node, [&area, &visitor](float const *x, float const *y, T const *items, const size_t count) {
+            for (uint32_t inside = inside_mask<BucketItemCount>(area, x, y, count); inside; inside &= inside - 1) {
+                const int i = std::countr_zero(inside);
+                visitor(items[i], Vector {x[i], y[i]});
+            }
+        });
+    }
+
+    // Calls visitor(data, position, d2) for every point of a leaf within area's radius, with its squared distance.
+    template<typename Visitor>
+    void for_each_in_leaf(const Circle area, const size_t node, Visitor &&visitor) const {
+        for_each_bucket(node, [&area, &visitor](float const *x, float const *y, T const *items, const size_t count) {
+            float d2[BucketItemCount];
+            uint32_t inside = within_mask<BucketItemCount>(area, x, y, count, d2);
+            for (; inside; inside &= inside - 1) {
+                const int i = std::countr_zero(inside);
+                visitor(items[i], Vector {x[i], y[i]}, d2[i]);
+            }
+        });
+    }
+
+    // Points in the tree, not counting the padding after the last run.
+    [[nodiscard]] inline size_t point_count() const {
+        return data.size() - BucketItemCount;
+    }
+
+    // Same contract as Quadtree::for_each_node.
+    template<typename Visitor>
+    void for_each_node(Visitor &&visitor) const {
+        struct Entry {
+            uint32_t node;
+            uint32_t depth;
+            Rectangle bound;
+        };
+
+        // Each level leaves at most three siblings waiting.
+        Entry stack[QuadtreeChildCount * (MaxDepth + 1)];
+        stack[0] = {0, 0, Rectangle {bounds}};
+        size_t top = 1;
+        while (top > 0) {
+            const Entry entry = stack[--top];
+            if (!visitor(size_t {entry.node}, size_t {entry.depth}, entry.bound) || !node_has_children(entry.node)) {
+                continue;
+            }
+
+            // Pushed last to first so the first quadrant is visited first.
+            const uint32_t first = nodes[entry.node].first;
+            const Vector size = entry.bound.size * 0.5f;
+            for (size_t quadrant = QuadtreeChildCount; quadrant-- > 0;) {
+                stack[top++] = {
+                    first + static_cast<uint32_t>(quadrant), entry.depth + 1,
+                    Rectangle {entry.bound.center + size * QuadrantOffsets[quadrant], size}
+                };
+            }
+        }
+    }
+
+    // Calls visitor(data, position) for every point inside area.
+    template<typename Visitor>
+    void for_each_in_range(const Rectangle area, Visitor &&visitor) const {
+        for_each_node([this, &area, &visitor](const size_t node, size_t, Rectangle const &bound) {
+            if (!bound.intersects(area)) {
+                return false;
+            }
+
+            if (!node_has_children(node)) {
+                for_each_in_leaf(area, node, visitor);
+            }
+
+            return true;
+        });
+    }
+
+    // Same contract as Quadtree::for_each_in_radius.
+    template<typename Visitor>
+    void for_each_in_radius(const Circle area, Visitor &&visitor) const {
+        const Rectangle square {area.bound()};
+        for_each_node([this, &area, &square, &visitor](const size_t node, size_t, Rectangle const &bound) {
+            if (!bound.intersects(square)) {
+                return false;
+            }
+
+            if (!node_has_children(node)) {
+                for_each_in_leaf(area, node, visitor);
+            }
+
+            return true;
+        });
+    }
+
+    void search(Rectangle area, std::vector<T> &search_results) const {
+        for_each_in_range(area, [&search_results](const T data, Vector) {
+            search_results.push_back(data);
+        });
+    }
+
+    void search(Circle area, std::vector<T> &search_results) const {
+        for_each_in_radius(area, [&search_results](const T data, Vector, float) {
+            search_results.push_back(data);
+        });
+    }
+
+    // Checks what the unchecked accessors rely on, and throws std::logic_error naming the first thing broken:
+    //   children come after their parent and every node is reached once, only MaxDepth leaves overflow a bucket,
+    //   the leaves' runs cover the points in order without overlapping, and points lie in their leaf.
+    // Returns the number of points. Costs a full walk.
+    size_t validate() const {
+        const auto fail = [](const char *what) {
+            throw std::logic_error(std::string {"FrozenQuadtree::validate: "} + what);
+        };
+
+        if (nodes.empty()) {
+            fail("no root");
+        }
+
+        std::vector<bool> node_seen(nodes.size());
+        size_t reached = 0;
+        size_t next_point = 0;
+
+        // A plain stack with the same order as for_each_node, which would not survive a cycle.
+        struct Entry {
+            size_t node;
+            size_t depth;
+            Rectangle bound;
+        };
+
+        std::vector<Entry> stack {{0, 0, Rectangle {bounds}}};
+        while (!stack.empty()) {
+            const Entry entry = stack.back();
+            stack.pop_back();
+            if (node_seen[entry.node]) {
+                fail("node reached twice");
+            }
+
+            node_seen[entry.node] = true;
+            ++reached;
+            Node const &node = nodes[entry.node];
+            if (node.count == Internal) {
+                if (node.first <= entry.node || node.first + QuadtreeChildCount > nodes.size() || entry.depth >= MaxDepth) {
+                    fail("children out of range, before their parent, or below MaxDepth");
+                }
+
+                const Vector size = entry.bound.size * 0.5f;
+                for (size_t quadrant = QuadtreeChildCount; quadrant-- > 0;) {
+                    stack.push_back({
+                        node.first + quadrant, entry.depth + 1,
+                        Rectangle {entry.bound.center + size * QuadrantOffsets[quadrant], size}
+                    });
+                }
+
+                continue;
+            }
+
+            if (node.first != next_point || node.first + node.count > point_count()) {
+                fail("leaf run out of order or out of range");
+            }
+
+            if (node.count > BucketItemCount && entry.depth != MaxDepth) {
+                fail("overfull leaf above MaxDepth");
+            }
+
+            for (size_t i = node.first; i < node.first + node.count; ++i) {
+                if (!within_rounding(entry.bound, Vector {xs[i], ys[i]})) {
+                    fail("point outside its leaf");
+                }
+            }
+
+            next_point += node.count;
+        }
+
+        if (xs.size() != data.size() || ys.size() != data.size() || data.size() < BucketItemCount) {
+            fail("point arrays disagree or lack padding");
+        }
+
+        if (reached != nodes.size() || next_point != point_count()) {
+            fail("unreachable nodes or points");
+        }
+
+        return next_point;
+    }
+
+    // Counted the way the Quadtree behind it stores leaves: full buckets chained behind a partly full head.
+    [[nodiscard]] Statistics statistics() const {
+        Statistics result;
+        result.nodes = size();
+
+        size_t chain_total = 0;
+        for_each_node([this, &result, &chain_total](const size_t node, const size_t depth, Rectangle const &) {
+            if (node_has_children(node)) {
+                return true;
+            }
+
+            const size_t count = nodes[node].count;
+            const size_t chain = std::max<size_t>((count + BucketItemCount - 1) / BucketItemCount, 1);
+            ++result.leaves;
+            ++result.leaves_per_depth.at(depth);
+            ++result.bucket_fill.at(count - (chain - 1) * BucketItemCount);
+            result.bucket_fill[BucketItemCount] += chain - 1;
+            result.items += count;
+            result.buckets += chain;
+
+            chain_total += chain;
+            result.longest_chain = std::max(result.longest_chain, chain);
+            result.chained_leaves += chain > 1;
+            return true;
+        });
+
+        if (result.leaves > 0) {
+            result.average_chain = static_cast<double>(chain_total) / static_cast<double>(result.leaves);
+        }
+
+        result.wasted_slots = result.buckets * BucketItemCount - result.items;
+        result.wasted_bytes = result.wasted_slots * (sizeof(T) + sizeof(Vector));
+        return result;
+    }
+
+    Rectangle bounds;
+    std::vector<Node> nodes;
+    std::vector<float> xs;
+    std::vector<float> ys;
+    std::vector<T> data;
+
+private:
+    // Sorted points [begin, end) of a node at depth.
+    struct Range {
+        uint32_t begin;
+        uint32_t end;
+        uint32_t depth;
+    };
+
+    struct Subtree {
+        std::vector<Node> nodes;
+        std::vector<Range> ranges;
+    };
+
+    // Makes into[i] a leaf over ranges[i], or an internal node with its children's nodes and ranges appended.
+    void expand(std::vector<Node> &into, std::vector<Range> &ranges_of, const size_t i) {
+        const Range range = ranges_of[i];
+        const uint32_t count = range.end - range.begin;
+        if (count <= BucketItemCount || range.depth == MaxDepth) {
+            // A Quadtree leaf holds its points in insertion order, which for bulk_load is the order of their data.
+            std::sort(values.begin() + range.begin, values.begin() + range.end);
+
+            if (count > BucketItemCount) {
+                chain_order(range.begin, range.end);
+            }
+
+            into[i] = {range.begin, count};
+            return;
+        }
+
+        // Keys in the range share their first depth quadrants and are sorted by the next one.
+        const uint32_t shift = 2 * static_cast<uint32_t>(MaxDepth - 1 - range.depth);
+        into[i].first = static_cast<uint32_t>(into.size());
+        uint32_t begin = range.begin;
+        for (uint32_t quadrant = 0; quadrant < QuadtreeChildCount; ++quadrant) {
+            const auto end = static_cast<uint32_t>(std::partition_point(
+                keys.begin() + begin, keys.begin() + range.end,
+                [shift, quadrant](const uint32_t key) { return (key >> shift & 0b11) <= quadrant; }
+            ) - keys.begin());
+
+            into.emplace_back();
+            ranges_of.push_back({begin, end, range.depth + 1});
+            begin = end;
+        }
+    }
+
+    // An overflowing Quadtree leaf lists its newest bucket first, then the older ones back to the first.
+    // Reorders the run of sorted values [begin, end) to match.
+    void chain_order(const uint32_t begin, const uint32_t end) {
+        uint32_t *run = values.data();
+        std::reverse(run + begin, run + end);
+        const uint32_t head = (end - begin - 1) % BucketItemCount + 1;
+        std::reverse(run + begin, run + begin + head);
+        for (uint32_t bucket = begin + head; bucket < end; bucket += BucketItemCount) {
+            std::reverse(run + bucket, run + bucket + BucketItemCount);
+        }
+    }
+
+    // Scratch for freeze.
+    std::vector<size_t> sources;
+    std::vector<uint32_t> frozen_index;
+
+    // Scratch for bulk_load.
+    std::vector<uint32_t> keys, values, key_scratch, value_scratch;
+    std::vector<Range> ranges;
+    std::vector<Subtree> subtrees;
+    std::vector<size_t> subtree_bases;
 };
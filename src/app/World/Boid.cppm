@@ -1,5 +1,6 @@
 module;
 #include "pch.hpp"
+#include <bit>
 export module Boid;
 
 
@@ -38,11 +39,12 @@ float Boid::disruptiveRadius = Boid::scale + 5.0f;
 float Boid::cohesiveRadius = 2.0f * Boid::disruptiveRadius;
 
 
+// Scalar path only. Batches of boids use the hardware estimate in Steering instead.
 export inline float fastInverseSqrt(const float d) {
     constexpr std::uint32_t magic = 0x5f3759df;
-    // reinterpret_cast doesn't appear to have too much effect compared to *(long*)&d
-    const std::uint32_t i = magic - (*reinterpret_cast<std::uint32_t*>(const_cast<float*>(&d)) >> 1);
-    const float y = *reinterpret_cast<float*>(const_cast<std::uint32_t*>(&i));
+    // bit_cast gives the same bits as the old pointer casts without the aliasing violation.
+    const std::uint32_t i = magic - (std::bit_cast<std::uint32_t>(d) >> 1);
+    const float y = std::bit_cast<float>(i);
     return y * (1.5f - (d * 0.5f * y * y));
 }
 
@@ -0,0 +1,148 @@
+module;
+#include "pch.hpp"
+export module BoidStore;
+
+import Boid;
+
+
+// Boid state as a structure of arrays: x, y, vx and vy live in one allocation, one after the other.
+// Every array starts on a cache line, so a loop that only reads positions never pulls velocities into cache
+//   and vector loads of whole lines stay aligned. Padding past count() is kept at zero.
+export class BoidStore {
+public:
+    static constexpr size_t Alignment = 64;
+    static constexpr size_t Lanes = Alignment / sizeof(float);  // Floats per cache line.
+
+    enum Component : size_t {
+        X, Y, VX, VY,
+        ComponentCount
+    };
+
+    // Floats from the start of one array to the start of the next.
+    static constexpr size_t stride_for(const size_t count) {
+        return std::max<size_t>((count + Lanes - 1) / Lanes, 1) * Lanes;
+    }
+
+    explicit BoidStore(const size_t count) : m_count(count), m_stride(stride_for(count)), m_data(allocate(m_stride)) {}
+
+    BoidStore(BoidStore &&) noexcept = default;
+    BoidStore &operator=(BoidStore &&) noexcept = default;
+    BoidStore(BoidStore const &) = delete;
+    BoidStore &operator=(BoidStore const &) = delete;
+
+    [[nodiscard]] float *component(const Component c) {
+        return m_data.get() + c * m_stride;
+    }
+
+    [[nodiscard]] float const *component(const Component c) const {
+        return m_data.get() + c * m_stride;
+    }
+
+    [[nodiscard]] float *x() { return component(X); }
+    [[nodiscard]] float *y() { return component(Y); }
+    [[nodiscard]] float *vx() { return component(VX); }
+    [[nodiscard]] float *vy() { return component(VY); }
+
+    [[nodiscard]] float const *x() const { return component(X); }
+    [[nodiscard]] float const *y() const { return component(Y); }
+    [[nodiscard]] float const *vx() const { return component(VX); }
+    [[nodiscard]] float const *vy() const { return component(VY); }
+
+    [[nodiscard]] Vector position(const size_t i) const {
+        return {x()[i], y()[i]};
+    }
+
+    [[nodiscard]] Vector velocity(const size_t i) const {
+        return {vx()[i], vy()[i]};
+    }
+
+    [[nodiscard]] Boid boid(const size_t i) const {
+        return {position(i), velocity(i)};
+    }
+
+    void set_position(const size_t i, const Vector position) {
+        x()[i] = position.x;
+        y()[i] = position.y;
+    }
+
+    void set_velocity(const size_t i, const Vector velocity) {
+        vx()[i] = velocity.x;
+        vy()[i] = velocity.y;
+    }
+
+    void set(const size_t i, Boid const &boid) {
+        set_position(i, boid.position);
+        set_velocity(i, boid.velocity);
+    }
+
+    // Copies every boid of a store with the same count.
+    void assign(BoidStore const &other) {
+        if (other.m_stride == m_stride) {
+            std::copy_n(other.m_data.get(), ComponentCount * m_stride, m_data.get());
+            return;
+        }
+
+        for (size_t c = 0; c < ComponentCount; ++c) {
+            std::copy_n(other.m_data.get() + c * other.m_stride, m_count, m_data.get() + c * m_stride);
+        }
+    }
+
+    // Keeps the first min(count, new_count) boids. New boids start at zero.
+    void resize(const size_t new_count) {
+        const size_t new_stride = stride_for(new_count);
+        if (new_stride != m_stride) {
+            Storage data {allocate(new_stride)};
+            const size_t kept = std::min(m_count, new_count);
+            for (size_t c = 0; c < ComponentCount; ++c) {
+                std::copy_n(m_data.get() + c * m_stride, kept, data.get() + c * new_stride);
+            }
+
+            m_data = std::move(data);
+            m_stride = new_stride;
+        } else if (new_count < m_count) {
+            for (size_t c = 0; c < ComponentCount; ++c) {
+                float *array = m_data.get() + c * m_stride;
+                std::fill(array + new_count, array + m_count, 0.0f);
+            }
+        }
+
+        m_count = new_count;
+    }
+
+    [[nodiscard]] size_t count() const {
+        return m_count;
+    }
+
+    [[nodiscard]] size_t stride() const {
+        return m_stride;
+    }
+
+    // The whole allocation, padding included, for uploading in one piece.
+    [[nodiscard]] float const *data() const {
+        return m_data.get();
+    }
+
+    [[nodiscard]] size_t bytes() const {
+        return ComponentCount * m_stride * sizeof(float);
+    }
+
+private:
+    struct AlignedDelete {
+        void operator()(float *data) const {
+            ::operator delete[](data, std::align_val_t {Alignment});
+        }
+    };
+
+    using Storage = std::unique_ptr<float[], AlignedDelete>;
+
+    static Storage allocate(const size_t stride) {
+        const size_t floats = ComponentCount * stride;
+        auto *data = static_cast<float *>(::operator new[](floats * sizeof(float), std::align_val_t {Alignment}));
+        std::fill_n(data, floats, 0.0f);
+        return Storage {data};
+    }
+
+    size_t m_count;
+    size_t m_stride;
+    Storage m_data;
+};
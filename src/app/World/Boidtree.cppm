@@ -5,85 +5,187 @@ export module Boidtree;
 import Quadtree;
 import Rectangle;
 import Boid;
+import BoidStore;
+import Steering;
 
 
-export typedef Quadtree<const Boid*> Boidtree;
-
-// Needs a self parameter to perform an identity check before dereference copy
-export void search(const Boidtree &tree, const Boid *self, Rectangle area, std::vector<Boid> &search_results) {
-    if (tree.bounds.intersects(area)) {
-        size_t indices[Boidtree::MaxDepth + 1];
-        indices[0] = 0;
-        indices[1] = tree.node_child(0, 0);
-        Rectangle terrace[Boidtree::MaxDepth + 1];  // TODO: test storing just centers
-        terrace[0] = Rectangle{tree.bounds};
-        if (!indices[1]) { return; }
-
-        // Array of 32 2-bit numbers. Saves the search quadrant of the current level when descending.
-        uint64_t quadrant_memory = 0;
-        int depth = 1;
-        bool ascended = false;
-
-        // Possible to abstract this loop?
-        while (true) {
-            // The last 2 bits of the state are the current quadrant
-            uint8_t quadrant = quadrant_memory & 0b11;
-            const size_t node_index = indices[depth];
-
-            // Critical operations happen when descending the tree
-            if (!ascended) {
-                Rectangle new_bound{terrace[depth - 1]};
-                new_bound.size = new_bound.size * 0.5f;
-                new_bound.center = new_bound.center + new_bound.size * QuadrantOffsets[quadrant];
-                terrace[depth] = new_bound;
-
-                if (tree.node_has_children(node_index) && new_bound.intersects(area)) {
-                    indices[++depth] = tree.node_child(node_index, 0);
-                    // Shift left 2 bits to go down
-                    quadrant_memory <<= 2;
-                    continue;
-                } else if (new_bound.intersects(area)) {
-                    // Bottom. Add my contents to the search.
-                    if (tree.node_bucket(node_index) > -1 && tree.bucket_size(tree.node_bucket(node_index)) > 0) {
-                        ptrdiff_t index = tree.node_bucket(node_index);
-                        Boidtree::BucketList const *list = &tree.lists.at(index);
-                        while(true) {
-                            for (size_t i = 0; i < list->size; ++i) {
-                                // Any way to make this branch-less?
-                                if (area.contains(tree.position(index, i)) && tree.data(index, i) != self) {
-                                    search_results.push_back(*tree.data(index, i));
-                                }
-                            }
-
-                            if (list->next == 0) {
-                                break;
-                            }
-
-                            index += list->next;
-                            list = &tree.lists.at(index);
-                        }
-                    }
-                }
-            }
+// Points are indices into the BoidStore the tree was built from.
+export typedef Quadtree<uint32_t> Boidtree;
+export typedef FrozenQuadtree<uint32_t> FrozenBoidtree;
+
+// Work done by neighbor searches. Only gathered when a SearchCounters is passed to search.
+export struct SearchCounters {
+    uint64_t searches = 0;
+    uint64_t nodes = 0;       // Nodes whose bounds were tested against the search area.
+    uint64_t candidates = 0;  // Points read from the leaves that intersected the area.
+    uint64_t returned = 0;    // Points inside the area, excluding the searching boid.
+    uint64_t cohesive = 0;    // Filled in by the caller after the distance test.
+    uint64_t disruptive = 0;
+
+    SearchCounters &operator+=(SearchCounters const &other) {
+        searches += other.searches;
+        nodes += other.nodes;
+        candidates += other.candidates;
+        returned += other.returned;
+        cohesive += other.cohesive;
+        disruptive += other.disruptive;
+        return *this;
+    }
+};
+
+// Search results are gathered as whole boids, straight into the arrays the steering kernels read,
+//   or as bare indices for the caller to read only the fields it needs.
+// Each call adds the count boids a bucket selected.
+void gather(std::vector<Boid> &results, BoidStore const &boids, uint32_t const *indices, const size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        results.push_back(boids.boid(indices[i]));
+    }
+}
+
+void gather(std::vector<uint32_t> &results, BoidStore const &, uint32_t const *indices, const size_t count) {
+    results.insert(results.end(), indices, indices + count);
+}
+
+void gather(Neighbors &results, BoidStore const &boids, uint32_t const *indices, const size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        results.push(boids.position(indices[i]), boids.velocity(indices[i]));
+    }
+}
+
+// The square whose nodes a search walks. A circle walks the nodes of the square around it, the same as
+//   Quadtree::for_each_in_radius, and leaves its corners to the point test.
+Rectangle node_area(Rectangle const &area) {
+    return area;
+}
 
-            ++quadrant;
+Rectangle node_area(Circle const &area) {
+    return area.bound();
+}
+
+// Picks the boids of one bucket inside area, except self. Only circles measure distances.
+size_t select(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *data, const size_t count,
+    const uint32_t self, uint32_t *selected, float *
+) {
+    return select_in_area(area, xs, ys, data, count, self, selected);
+}
 
-            if (quadrant >= QuadtreeChildCount) {
-                // Shift right 2 bits to go up
-                quadrant_memory >>= 2;
-                ascended = true;
-                --depth;
+size_t select(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *data, const size_t count,
+    const uint32_t self, uint32_t *selected, float *distances
+) {
+    return select_in_radius(area, xs, ys, data, count, self, selected, distances);
+}
+
+// Walks the leaves that intersect node_area(area) and calls found(indices, distances, count) with the boids of each
+//   bucket inside area, except self. Buckets are tested a whole bucket at a time by the SIMD kernels in Steering.
+// Area is a Rectangle or a Circle; distances are the boids' squared distances from a Circle's center.
+// Tree is Boidtree or FrozenBoidtree.
+template<bool Counted, typename Tree, typename Area, typename Found>
+void select_tree(Tree const &tree, const uint32_t self, Area const &area, Found &&found, SearchCounters *counters) {
+    static_assert(Tree::BucketItemCount == SelectWidth);
+    const Rectangle square {node_area(area)};
+    if constexpr (Counted) {
+        ++counters->searches;
+    }
+
+    tree.for_each_node([&](const size_t node, size_t, Rectangle const &bound) {
+        if constexpr (Counted) {
+            ++counters->nodes;
+        }
 
-                if (!depth) {
-                    break;
+        if (!bound.intersects(square)) {
+            return false;
+        }
+
+        if (!tree.node_has_children(node)) {
+            tree.for_each_bucket(node, [&](float const *xs, float const *ys, uint32_t const *data, const size_t count) {
+                uint32_t selected[SelectWidth];
+                float distances[SelectWidth];
+                const size_t inside = select(area, xs, ys, data, count, self, selected, distances);
+                if constexpr (Counted) {
+                    counters->candidates += count;
+                    counters->returned += inside;
                 }
-            } else {
-                indices[depth] = tree.node_child(indices[depth - 1], quadrant);
-                quadrant_memory += 1;
-                ascended = false;
-            }
+
+                found(selected, distances, inside);
+            });
         }
-    }
+
+        return true;
+    });
 }
 
+// Calls visitor(index) for every boid inside area except self, straight from the leaves.
+// Fused searches run the visitor inline, so nothing is gathered and nothing is allocated.
+// Tree is Boidtree or FrozenBoidtree, here and in search.
+export template<typename Tree, typename Visitor>
+void for_each_neighbor(Tree const &tree, const uint32_t self, const Rectangle area, Visitor &&visitor) {
+    select_tree<false>(tree, self, area, [&visitor](uint32_t const *indices, float const *, const size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            visitor(indices[i]);
+        }
+    }, nullptr);
+}
 
+// Calls visitor(index, d2) for every boid strictly within area's radius except self, with its squared distance.
+export template<typename Tree, typename Visitor>
+void for_each_neighbor(Tree const &tree, const uint32_t self, const Circle area, Visitor &&visitor) {
+    select_tree<false>(tree, self, area, [&visitor](uint32_t const *indices, float const *d2, const size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            visitor(indices[i], d2[i]);
+        }
+    }, nullptr);
+}
+
+// Needs a self parameter to perform an identity check before gathering the boid
+// Squared distances are appended to distances alongside the results when it is given and area is a Circle.
+template<bool Counted, typename Tree, typename Area, typename Results>
+void search_tree(
+    Tree const &tree, BoidStore const &boids, const uint32_t self, Area const &area,
+    Results &search_results, std::vector<float> *distances, SearchCounters *counters
+) {
+    const auto found = [&](uint32_t const *indices, float const *d2, const size_t count) {
+        gather(search_results, boids, indices, count);
+        if (distances) {
+            distances->insert(distances->end(), d2, d2 + count);
+        }
+    };
+
+    select_tree<Counted>(tree, self, area, found, counters);
+}
+
+// Results is std::vector<Boid>, Neighbors or std::vector<uint32_t>.
+export template<typename Tree, typename Results>
+void search(
+    Tree const &tree, BoidStore const &boids, const uint32_t self, Rectangle area, Results &search_results
+) {
+    search_tree<false>(tree, boids, self, area, search_results, nullptr, nullptr);
+}
+
+export template<typename Tree, typename Results>
+void search(
+    Tree const &tree, BoidStore const &boids, const uint32_t self, Rectangle area, Results &search_results,
+    SearchCounters &counters
+) {
+    search_tree<true>(tree, boids, self, area, search_results, nullptr, &counters);
+}
+
+// The boids strictly within area's radius. The corners of the square search are dropped by the point test, before
+//   anything is gathered. With distances, each boid's squared distance is appended in step with the results, ready
+//   for accumulate_neighbors.
+export template<typename Tree, typename Results>
+void search(
+    Tree const &tree, BoidStore const &boids, const uint32_t self, Circle area, Results &search_results,
+    std::vector<float> *distances = nullptr
+) {
+    search_tree<false>(tree, boids, self, area, search_results, distances, nullptr);
+}
+
+export template<typename Tree, typename Results>
+void search(
+    Tree const &tree, BoidStore const &boids, const uint32_t self, Circle area, Results &search_results,
+    std::vector<float> *distances, SearchCounters &counters
+) {
+    search_tree<true>(tree, boids, self, area, search_results, distances, &counters);
+}
@@ -1,32 +1,139 @@
 module;
 #include "pch.hpp"
+#include <numeric>
+#include <random>
 export module Flock;
 
 import Algorithm;
 import DoubleBuffer;
 import Boid;
+import BoidStore;
+import HardwareCounters;
+import Morton;
+import Profiler;
+
+const ProfileZone AlgorithmUpdateZone {"Algorithm::update"};
+const ProfileZone FlipZone {"DoubleBuffer::flip"};
+const ProfileZone ReorderZone {"Flock::reorder"};
 
 
 export class Flock {
     // without any steering, this number can go above 500,000 before dipping below 60fps
     size_t m_count;
-    DoubleBuffer<Boid> m_flock;
+    DoubleBuffer<BoidStore> m_flock;
 
-public:
-    explicit Flock(const size_t flock_size) : m_count(flock_size), m_flock(flock_size) {
-        // Set up boid starting locations
-        Boid *writable = m_flock.write();
+    // Stable identity of the boid in each slot. Only differs from the slot once the flock has been reordered.
+    std::vector<uint32_t> m_ids;
+
+    size_t m_reorder_interval = 0;
+    size_t m_updates_since_reorder = 0;
+    std::vector<uint32_t> m_keys, m_order, m_key_scratch, m_order_scratch;
 
+    // Spacing of the starting spiral. Seeded layouts scatter over the same disc.
+    static constexpr float Spacing = 7.5f;
+
+    void spiral(BoidStore &writable) const {
         float angle = 0.0f;
         for (ptrdiff_t i = 0; i < m_count; i++) {
-            constexpr float d = 7.5f;
-            auto & [position, velocity] = writable[i];
             //auto angle = static_cast<float>(i) * tauOverSize;
             const float radius = glm::sqrt(static_cast<float>(i + 1));
             angle += glm::asin(1.0f / radius);
-            Vector offsets{glm::cos(angle) * radius * d, glm::sin(angle) * radius * d};
-            position = offsets;
-            velocity = magnitude(10.0f * offsets + angle, Boid::maxSpeed);
+            Vector offsets{glm::cos(angle) * radius * Spacing, glm::sin(angle) * radius * Spacing};
+            writable.set_position(i, offsets);
+            writable.set_velocity(i, magnitude(10.0f * offsets + angle, Boid::maxSpeed));
+        }
+    }
+
+    // Moves the boid in slot order[i] to slot i, carrying its identity along.
+    void permute(std::vector<uint32_t> const &order) {
+        BoidStore const &read = m_flock.read();
+        BoidStore &write = m_flock.write();
+        for (size_t c = 0; c < BoidStore::ComponentCount; ++c) {
+            const auto component = static_cast<BoidStore::Component>(c);
+            float const *from = read.component(component);
+            float *to = write.component(component);
+            for (size_t i = 0; i < m_count; ++i) {
+                to[i] = from[order[i]];
+            }
+        }
+
+        m_order_scratch.resize(m_count);
+        for (size_t i = 0; i < m_count; ++i) {
+            m_order_scratch[i] = m_ids[order[i]];
+        }
+
+        m_ids.swap(m_order_scratch);
+        m_flock.flip();
+    }
+
+    // Sorts the flock by the Morton code of each position, so boids near each other in space are near each other
+    //   in memory. Neighbor reads during the next updates then mostly hit cache lines already loaded.
+    void reorder() {
+        ProfileScope profile {ReorderZone};
+        BoidStore const &read = m_flock.read();
+        float const *x = read.x();
+        float const *y = read.y();
+
+        Vector low {std::numeric_limits<float>::max()};
+        Vector high {std::numeric_limits<float>::lowest()};
+        for (size_t i = 0; i < m_count; ++i) {
+            low = glm::min(low, Vector {x[i], y[i]});
+            high = glm::max(high, Vector {x[i], y[i]});
+        }
+
+        const MortonQuantizer quantize {low, high};
+        m_keys.resize(m_count);
+        m_order.resize(m_count);
+        for (size_t i = 0; i < m_count; ++i) {
+            m_keys[i] = quantize(x[i], y[i]);
+            m_order[i] = static_cast<uint32_t>(i);
+        }
+
+        radix_sort(m_keys, m_order, m_key_scratch, m_order_scratch);
+        permute(m_order);
+    }
+
+    // Puts every boid back in the slot matching its identity.
+    void restore_order() {
+        m_order.resize(m_count);
+        for (size_t i = 0; i < m_count; ++i) {
+            m_order[m_ids[i]] = static_cast<uint32_t>(i);
+        }
+
+        permute(m_order);
+    }
+
+    void scatter(BoidStore &writable, const uint32_t seed) const {
+        // std::mt19937's output is fixed by the standard but the library distributions are not,
+        //   so turn its bits into floats here to get the same layout from every compiler.
+        std::mt19937 generator {seed};
+        const auto unit = [&generator]() {
+            return static_cast<float>(generator() >> 8) * (1.0f / 16777216.0f);
+        };
+
+        const float disc_radius = Spacing * glm::sqrt(static_cast<float>(m_count));
+        for (ptrdiff_t i = 0; i < m_count; i++) {
+            const float radius = disc_radius * glm::sqrt(unit());
+            const float angle = glm::two_pi<float>() * unit();
+            const float heading = glm::two_pi<float>() * unit();
+            writable.set_position(i, Vector {glm::cos(angle) * radius, glm::sin(angle) * radius});
+            writable.set_velocity(i, Vector {glm::cos(heading), glm::sin(heading)} * Boid::maxSpeed);
+        }
+    }
+
+public:
+    // Seed 0 keeps the classic spiral. Any other seed scatters the flock randomly, but the same way every run.
+    explicit Flock(const size_t flock_size, const uint32_t seed = 0) :
+        m_count(flock_size), m_flock(flock_size), m_ids(flock_size)
+    {
+        std::iota(m_ids.begin(), m_ids.end(), 0u);
+
+        // Set up boid starting locations
+        BoidStore &writable = m_flock.write();
+        if (seed == 0) {
+            spiral(writable);
+        } else {
+            scatter(writable, seed);
         }
 
         m_flock.flip();
@@ -34,13 +141,37 @@ public:
 
     void update(Algorithm *algorithm, const float dt) {
         // Run the given algorithm
-        algorithm->update(m_flock, dt);
+        {
+            ProfileScope profile {AlgorithmUpdateZone};
+            CounterScope counters {m_count};
+            algorithm->update(m_flock, dt);
+        }
 
-        // Push changes to flock
-        m_flock.flip();
+        // Push changes to flock. A swap, not a copy.
+        {
+            ProfileScope profile {FlipZone};
+            m_flock.flip();
+        }
+
+        if (m_reorder_interval > 0 && ++m_updates_since_reorder >= m_reorder_interval) {
+            reorder();
+            algorithm->invalidate();
+            m_updates_since_reorder = 0;
+        }
+    }
+
+    // Sort the flock into Morton order after every interval updates. 0 turns reordering off.
+    void reorder_every(const size_t interval) {
+        m_reorder_interval = interval;
+        m_updates_since_reorder = 0;
+    }
+
+    // Identity of the boid in each slot of boids(). Identities follow boids through reordering.
+    [[nodiscard]] std::vector<uint32_t> const &ids() const {
+        return m_ids;
     }
 
-    [[nodiscard]] Boid const *boids() const {
+    [[nodiscard]] BoidStore const &boids() const {
         return m_flock.read();
     }
 
@@ -49,17 +180,31 @@ public:
     }
 
     void resize(const size_t size) {
-        if (size > m_count) {
+        if (size == m_count) {
+            return;
+        }
+
+        // Shrinking keeps the lowest identities, so they have to be back in their own slots first.
+        if (!std::is_sorted(m_ids.begin(), m_ids.end())) {
+            restore_order();
+        }
 
-            Boid *write = m_flock.write();
+        m_flock.resize(size);
+        m_ids.resize(size);
+        std::iota(m_ids.begin(), m_ids.end(), 0u);
+        if (size > m_count) {
+            // Only the new boids are written here, so start from the current state.
+            m_flock.refill_write();
+            BoidStore &write = m_flock.write();
             const float tauOverSize = glm::two_pi<float>() / static_cast<float>(m_count);
             for (size_t i = m_count; i < size; i++) {
-                auto &[position, velocity] = write[i];
                 const auto angle = static_cast<float>(i) * tauOverSize;
                 Vector offsets{cosf(angle), sinf(angle)};
-                position = 50.0f * offsets;
-                velocity = magnitude(10.0f * offsets + angle, Boid::maxSpeed);
+                write.set_position(i, 50.0f * offsets);
+                write.set_velocity(i, magnitude(10.0f * offsets + angle, Boid::maxSpeed));
             }
+
+            m_flock.flip();
         }
 
         m_count = size;
@@ -0,0 +1,1144 @@
+module;
+#include "pch.hpp"
+#include <bit>
+#include <span>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FLOX_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic in any function. GCC and Clang need the target named on the function.
+// Small helpers are forced inline: lane structs passed by value to an outlined call go through memory.
+#if defined(__GNUC__) || defined(__clang__)
+#define FLOX_TARGET(isa) __attribute__((target(isa)))
+#define FLOX_INLINE_TARGET(isa) __attribute__((target(isa), always_inline)) inline
+#else
+#define FLOX_TARGET(isa)
+#define FLOX_INLINE_TARGET(isa) __forceinline
+#endif
+export module Steering;
+
+import Boid;
+import BoidStore;
+import Rectangle;
+
+// The steering step in two halves. accumulate_neighbors runs the distance tests against every neighbor a search
+//   returned and sums separation, alignment and cohesion; vector kernels take 4, 8 or 16 neighbors at a time.
+//   Neighbors come either copied into a Neighbors or as indices into the BoidStore.
+// steer_block then turns a block of those sums into accelerations and moves the boids, 8 or 16 boids at a time.
+// select_in_area and select_in_radius are the search's side of it: they pick the points of a quadtree bucket inside
+//   the search area. The radius version also measures each point's squared distance, which the sums can reuse.
+// Kernels are picked once at startup from what the CPU supports. Vector kernels add neighbors in a different order
+//   and use the hardware reciprocal square root, so they can differ from the scalar path in the last bits.
+
+
+export enum class SimdLevel {
+    Scalar,
+    SSE4,
+    AVX2,
+    AVX512
+};
+
+export constexpr std::array<const char *, 4> SimdLevelNames {"scalar", "sse4", "avx2", "avx512"};
+
+
+// Neighbors as a structure of arrays, filled by search.
+export struct Neighbors {
+    std::vector<float> x, y, vx, vy;
+
+    void clear() {
+        x.clear();
+        y.clear();
+        vx.clear();
+        vy.clear();
+    }
+
+    void reserve(const size_t count) {
+        x.reserve(count);
+        y.reserve(count);
+        vx.reserve(count);
+        vy.reserve(count);
+    }
+
+    void push(const Vector position, const Vector velocity) {
+        x.push_back(position.x);
+        y.push_back(position.y);
+        vx.push_back(velocity.x);
+        vy.push_back(velocity.y);
+    }
+
+    [[nodiscard]] size_t size() const {
+        return x.size();
+    }
+};
+
+
+// Sums over the neighbors inside each radius. Averaging and steering is left to the caller.
+export struct NeighborSums {
+    Vector separation {0.0f};  // Sum of (position - other) / (d2 + Epsilon) over disruptive neighbors.
+    Vector alignment {0.0f};   // Sum of cohesive neighbor velocities.
+    Vector cohesion {0.0f};    // Sum of cohesive neighbor positions.
+    uint32_t disruptive = 0;
+    uint32_t cohesive = 0;
+};
+
+
+// Radii are squared.
+export NeighborSums accumulate_neighbors(
+    Vector position, Neighbors const &neighbors, float disruptive_radius, float cohesive_radius
+);
+
+// Same sums, reading each neighbor straight out of the store by index instead of from a copy.
+export NeighborSums accumulate_neighbors(
+    Vector position, BoidStore const &boids, std::span<const uint32_t> indices,
+    float disruptive_radius, float cohesive_radius
+);
+
+// Same again with the squared distance of each neighbor from position already measured, as select_in_radius does.
+export NeighborSums accumulate_neighbors(
+    Vector position, BoidStore const &boids, std::span<const uint32_t> indices, std::span<const float> distances,
+    float disruptive_radius, float cohesive_radius
+);
+
+// Points a bucket is tested in. Same as the quadtree's BucketItemCount.
+export constexpr size_t SelectWidth = 8;
+
+// Copies the indices of the count points at xs and ys that are inside area, other than skip, to selected in order,
+//   and returns how many there were. Inside is by the same comparisons as Rectangle::contains.
+// Reads SelectWidth entries of each array however small count is, and may write SelectWidth entries to selected.
+export size_t select_in_area(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *indices, size_t count, uint32_t skip,
+    uint32_t *selected
+);
+
+// Same for the points strictly within area's radius, as in Circle::contains. Their squared distances from the center
+//   go to distances, in the same order, measured the way accumulate_neighbors measures them at the same SIMD level.
+// Writes SelectWidth entries to distances as well.
+export size_t select_in_radius(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *indices, size_t count, uint32_t skip,
+    uint32_t *selected, float *distances
+);
+
+// The best level this CPU supports.
+export SimdLevel detected_simd_level();
+
+// Levels above detected_simd_level() are lowered to it. Call before any worker thread starts.
+export void set_simd_level(SimdLevel level);
+
+export SimdLevel simd_level();
+
+
+// Neighbor sums for a block of consecutive boids, one lane per boid.
+export struct SteeringBlock {
+    static constexpr size_t Capacity = 16;
+
+    void set(const size_t lane, NeighborSums const &sums) {
+        separation_x[lane] = sums.separation.x;
+        separation_y[lane] = sums.separation.y;
+        alignment_x[lane] = sums.alignment.x;
+        alignment_y[lane] = sums.alignment.y;
+        cohesion_x[lane] = sums.cohesion.x;
+        cohesion_y[lane] = sums.cohesion.y;
+        disruptive[lane] = static_cast<float>(sums.disruptive);
+        cohesive[lane] = static_cast<float>(sums.cohesive);
+    }
+
+    alignas(64) std::array<float, Capacity> separation_x {}, separation_y {};
+    alignas(64) std::array<float, Capacity> alignment_x {}, alignment_y {};
+    alignas(64) std::array<float, Capacity> cohesion_x {}, cohesion_y {};
+    alignas(64) std::array<float, Capacity> disruptive {}, cohesive {};
+};
+
+
+// Finishes the steering step for count boids starting at first: averages the block's sums, adds the steering
+//   toward the center, and writes the new velocity and position of each boid. Boids outside the block are untouched.
+export void steer_block(
+    SteeringBlock const &block, size_t count, BoidStore const &read, BoidStore &write, size_t first,
+    Rectangle center_bound, Rectangle hard_bound, float delta
+);
+
+
+// Where a kernel reads its neighbors from: the packed arrays of a Neighbors, or a BoidStore through a list of
+//   indices. Indexed sources use the hardware gathers where there are any.
+struct PackedSource {
+    float const *x, *y, *vx, *vy;
+    size_t count;
+
+    [[nodiscard]] float get(float const *array, const size_t i) const {
+        return array[i];
+    }
+};
+
+struct IndexedSource {
+    float const *x, *y, *vx, *vy;
+    uint32_t const *indices;
+    size_t count;
+
+    [[nodiscard]] float get(float const *array, const size_t i) const {
+        return array[indices[i]];
+    }
+};
+
+// An IndexedSource whose squared distances were measured by the search, one for each index.
+struct MeasuredSource : IndexedSource {
+    float const *d2;
+};
+
+template<typename Source>
+using Kernel = NeighborSums (*)(Vector, Source const &, float, float);
+
+template<typename Source>
+static float distance2(Source const &, const Vector position, const Vector other, size_t) {
+    return glm::distance2(position, other);
+}
+
+static float distance2(MeasuredSource const &source, Vector, Vector, const size_t i) {
+    return source.d2[i];
+}
+
+// Also finishes the neighbors the vector kernels leave over, starting at first.
+template<typename Source>
+static NeighborSums accumulate_scalar(
+    const Vector position, Source const &source, const float disruptive_radius, const float cohesive_radius,
+    const size_t first
+) {
+    NeighborSums sums;
+    for (size_t i = first; i < source.count; ++i) {
+        const Vector other {source.get(source.x, i), source.get(source.y, i)};
+        const float d2 = distance2(source, position, other, i);
+
+        const size_t is_disruptive = d2 < disruptive_radius;
+        const size_t is_cohesive = d2 < cohesive_radius;
+
+        sums.separation += FloatEnable[is_disruptive] * ((position - other) / (d2 + Epsilon));
+        sums.alignment += FloatEnable[is_cohesive] * Vector {source.get(source.vx, i), source.get(source.vy, i)};
+        sums.cohesion += FloatEnable[is_cohesive] * other;
+
+        sums.disruptive += is_disruptive;
+        sums.cohesive += is_cohesive;
+    }
+
+    return sums;
+}
+
+template<typename Source>
+static NeighborSums scalar_kernel(
+    const Vector position, Source const &source, const float disruptive_radius, const float cohesive_radius
+) {
+    return accumulate_scalar(position, source, disruptive_radius, cohesive_radius, 0);
+}
+
+#ifdef FLOX_X86
+static void add_tail(NeighborSums &sums, NeighborSums const &tail) {
+    sums.separation += tail.separation;
+    sums.alignment += tail.alignment;
+    sums.cohesion += tail.cohesion;
+    sums.disruptive += tail.disruptive;
+    sums.cohesive += tail.cohesive;
+}
+
+FLOX_INLINE_TARGET("sse4.1") static float horizontal_sum(const __m128 v) {
+    const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 0b01)));
+}
+
+FLOX_INLINE_TARGET("sse4.1") static uint32_t horizontal_sum(const __m128i v) {
+    const __m128i pairs = _mm_add_epi32(v, _mm_unpackhi_epi64(v, v));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_add_epi32(pairs, _mm_shuffle_epi32(pairs, 0b01))));
+}
+
+FLOX_INLINE_TARGET("sse4.1") static __m128 load4(PackedSource const &source, float const *array, const size_t i) {
+    return _mm_loadu_ps(array + i);
+}
+
+// SSE has no gather. Four scalar loads are still cheaper than copying the neighbor out first.
+FLOX_INLINE_TARGET("sse4.1") static __m128 load4(IndexedSource const &source, float const *array, const size_t i) {
+    uint32_t const *index = source.indices + i;
+    return _mm_setr_ps(array[index[0]], array[index[1]], array[index[2]], array[index[3]]);
+}
+
+template<typename Source>
+FLOX_INLINE_TARGET("sse4.1") static __m128 distance2(Source const &, const __m128 dx, const __m128 dy, size_t) {
+    return _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+}
+
+FLOX_INLINE_TARGET("sse4.1") static __m128 distance2(MeasuredSource const &source, __m128, __m128, const size_t i) {
+    return _mm_loadu_ps(source.d2 + i);
+}
+
+template<typename Source>
+FLOX_TARGET("sse4.1") static NeighborSums sse4_kernel(
+    const Vector position, Source const &source, const float disruptive_radius, const float cohesive_radius
+) {
+    const __m128 px = _mm_set1_ps(position.x);
+    const __m128 py = _mm_set1_ps(position.y);
+    const __m128 disruptive_limit = _mm_set1_ps(disruptive_radius);
+    const __m128 cohesive_limit = _mm_set1_ps(cohesive_radius);
+    const __m128 epsilon = _mm_set1_ps(Epsilon);
+
+    __m128 sx = _mm_setzero_ps(), sy = _mm_setzero_ps();
+    __m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps();
+    __m128 cx = _mm_setzero_ps(), cy = _mm_setzero_ps();
+    __m128i disruptive = _mm_setzero_si128(), cohesive = _mm_setzero_si128();
+
+    const size_t count = source.count;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 ox = load4(source, source.x, i);
+        const __m128 oy = load4(source, source.y, i);
+        const __m128 dx = _mm_sub_ps(px, ox);
+        const __m128 dy = _mm_sub_ps(py, oy);
+        const __m128 d2 = distance2(source, dx, dy, i);
+
+        // All ones where true, so the masks select with an and and count by subtracting -1.
+        const __m128 is_disruptive = _mm_cmplt_ps(d2, disruptive_limit);
+        const __m128 is_cohesive = _mm_cmplt_ps(d2, cohesive_limit);
+
+        const __m128 denominator = _mm_add_ps(d2, epsilon);
+        sx = _mm_add_ps(sx, _mm_and_ps(is_disruptive, _mm_div_ps(dx, denominator)));
+        sy = _mm_add_ps(sy, _mm_and_ps(is_disruptive, _mm_div_ps(dy, denominator)));
+        ax = _mm_add_ps(ax, _mm_and_ps(is_cohesive, load4(source, source.vx, i)));
+        ay = _mm_add_ps(ay, _mm_and_ps(is_cohesive, load4(source, source.vy, i)));
+        cx = _mm_add_ps(cx, _mm_and_ps(is_cohesive, ox));
+        cy = _mm_add_ps(cy, _mm_and_ps(is_cohesive, oy));
+
+        disruptive = _mm_sub_epi32(disruptive, _mm_castps_si128(is_disruptive));
+        cohesive = _mm_sub_epi32(cohesive, _mm_castps_si128(is_cohesive));
+    }
+
+    NeighborSums sums {
+        {horizontal_sum(sx), horizontal_sum(sy)},
+        {horizontal_sum(ax), horizontal_sum(ay)},
+        {horizontal_sum(cx), horizontal_sum(cy)},
+        horizontal_sum(disruptive), horizontal_sum(cohesive)
+    };
+
+    add_tail(sums, accumulate_scalar(position, source, disruptive_radius, cohesive_radius, i));
+    return sums;
+}
+
+// Written out again instead of calling the SSE versions: those are compiled without VEX encoding,
+//   and mixing them with 256-bit code costs a state transition on every call.
+FLOX_INLINE_TARGET("avx2") static float horizontal_sum(const __m256 v) {
+    const __m128 halves = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 pairs = _mm_add_ps(halves, _mm_movehl_ps(halves, halves));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 0b01)));
+}
+
+FLOX_INLINE_TARGET("avx2") static uint32_t horizontal_sum(const __m256i v) {
+    const __m128i halves = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    const __m128i pairs = _mm_add_epi32(halves, _mm_unpackhi_epi64(halves, halves));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_add_epi32(pairs, _mm_shuffle_epi32(pairs, 0b01))));
+}
+
+FLOX_INLINE_TARGET("avx2") static __m256 load8(PackedSource const &source, float const *array, const size_t i) {
+    return _mm256_loadu_ps(array + i);
+}
+
+FLOX_INLINE_TARGET("avx2") static __m256 load8(IndexedSource const &source, float const *array, const size_t i) {
+    const __m256i index = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(source.indices + i));
+    return _mm256_i32gather_ps(array, index, sizeof(float));
+}
+
+template<typename Source>
+FLOX_INLINE_TARGET("avx2") static __m256 distance2(Source const &, const __m256 dx, const __m256 dy, size_t) {
+    return _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+}
+
+FLOX_INLINE_TARGET("avx2") static __m256 distance2(MeasuredSource const &source, __m256, __m256, const size_t i) {
+    return _mm256_loadu_ps(source.d2 + i);
+}
+
+template<typename Source>
+FLOX_TARGET("avx2") static NeighborSums avx2_kernel(
+    const Vector position, Source const &source, const float disruptive_radius, const float cohesive_radius
+) {
+    const __m256 px = _mm256_set1_ps(position.x);
+    const __m256 py = _mm256_set1_ps(position.y);
+    const __m256 disruptive_limit = _mm256_set1_ps(disruptive_radius);
+    const __m256 cohesive_limit = _mm256_set1_ps(cohesive_radius);
+    const __m256 epsilon = _mm256_set1_ps(Epsilon);
+
+    __m256 sx = _mm256_setzero_ps(), sy = _mm256_setzero_ps();
+    __m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps();
+    __m256 cx = _mm256_setzero_ps(), cy = _mm256_setzero_ps();
+    __m256i disruptive = _mm256_setzero_si256(), cohesive = _mm256_setzero_si256();
+
+    const size_t count = source.count;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 ox = load8(source, source.x, i);
+        const __m256 oy = load8(source, source.y, i);
+        const __m256 dx = _mm256_sub_ps(px, ox);
+        const __m256 dy = _mm256_sub_ps(py, oy);
+        const __m256 d2 = distance2(source, dx, dy, i);
+
+        const __m256 is_disruptive = _mm256_cmp_ps(d2, disruptive_limit, _CMP_LT_OQ);
+        const __m256 is_cohesive = _mm256_cmp_ps(d2, cohesive_limit, _CMP_LT_OQ);
+
+        const __m256 denominator = _mm256_add_ps(d2, epsilon);
+        sx = _mm256_add_ps(sx, _mm256_and_ps(is_disruptive, _mm256_div_ps(dx, denominator)));
+        sy = _mm256_add_ps(sy, _mm256_and_ps(is_disruptive, _mm256_div_ps(dy, denominator)));
+        ax = _mm256_add_ps(ax, _mm256_and_ps(is_cohesive, load8(source, source.vx, i)));
+        ay = _mm256_add_ps(ay, _mm256_and_ps(is_cohesive, load8(source, source.vy, i)));
+        cx = _mm256_add_ps(cx, _mm256_and_ps(is_cohesive, ox));
+        cy = _mm256_add_ps(cy, _mm256_and_ps(is_cohesive, oy));
+
+        disruptive = _mm256_sub_epi32(disruptive, _mm256_castps_si256(is_disruptive));
+        cohesive = _mm256_sub_epi32(cohesive, _mm256_castps_si256(is_cohesive));
+    }
+
+    NeighborSums sums {
+        {horizontal_sum(sx), horizontal_sum(sy)},
+        {horizontal_sum(ax), horizontal_sum(ay)},
+        {horizontal_sum(cx), horizontal_sum(cy)},
+        horizontal_sum(disruptive), horizontal_sum(cohesive)
+    };
+
+    // The scalar tail is plain SSE code. Clear the upper halves first or every SSE instruction in it stalls.
+    _mm256_zeroupper();
+    add_tail(sums, accumulate_scalar(position, source, disruptive_radius, cohesive_radius, i));
+    return sums;
+}
+
+FLOX_INLINE_TARGET("avx512f") static __m512 load16(
+    PackedSource const &source, float const *array, const size_t i, const __mmask16 lanes
+) {
+    return _mm512_maskz_loadu_ps(lanes, array + i);
+}
+
+FLOX_INLINE_TARGET("avx512f") static __m512 load16(
+    IndexedSource const &source, float const *array, const size_t i, const __mmask16 lanes
+) {
+    const __m512i index = _mm512_maskz_loadu_epi32(lanes, source.indices + i);
+    return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes, index, array, sizeof(float));
+}
+
+template<typename Source>
+FLOX_INLINE_TARGET("avx512f") static __m512 distance2(
+    Source const &, const __m512 dx, const __m512 dy, size_t, __mmask16
+) {
+    return _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+}
+
+FLOX_INLINE_TARGET("avx512f") static __m512 distance2(
+    MeasuredSource const &source, __m512, __m512, const size_t i, const __mmask16 lanes
+) {
+    return _mm512_maskz_loadu_ps(lanes, source.d2 + i);
+}
+
+// AVX-512 has real mask registers, so the tail runs as one more masked iteration instead of a scalar loop.
+template<typename Source>
+FLOX_TARGET("avx512f") static NeighborSums avx512_kernel(
+    const Vector position, Source const &source, const float disruptive_radius, const float cohesive_radius
+) {
+    const __m512 px = _mm512_set1_ps(position.x);
+    const __m512 py = _mm512_set1_ps(position.y);
+    const __m512 disruptive_limit = _mm512_set1_ps(disruptive_radius);
+    const __m512 cohesive_limit = _mm512_set1_ps(cohesive_radius);
+    const __m512 epsilon = _mm512_set1_ps(Epsilon);
+
+    __m512 sx = _mm512_setzero_ps(), sy = _mm512_setzero_ps();
+    __m512 ax = _mm512_setzero_ps(), ay = _mm512_setzero_ps();
+    __m512 cx = _mm512_setzero_ps(), cy = _mm512_setzero_ps();
+    uint32_t disruptive = 0, cohesive = 0;
+
+    const size_t count = source.count;
+    for (size_t i = 0; i < count; i += 16) {
+        const size_t remaining = count - i;
+        const auto lanes = static_cast<__mmask16>(remaining >= 16 ? 0xFFFF : (1u << remaining) - 1);
+
+        const __m512 ox = load16(source, source.x, i, lanes);
+        const __m512 oy = load16(source, source.y, i, lanes);
+        const __m512 dx = _mm512_sub_ps(px, ox);
+        const __m512 dy = _mm512_sub_ps(py, oy);
+        const __m512 d2 = distance2(source, dx, dy, i, lanes);
+
+        const __mmask16 is_disruptive = _mm512_mask_cmp_ps_mask(lanes, d2, disruptive_limit, _CMP_LT_OQ);
+        const __mmask16 is_cohesive = _mm512_mask_cmp_ps_mask(lanes, d2, cohesive_limit, _CMP_LT_OQ);
+
+        const __m512 denominator = _mm512_add_ps(d2, epsilon);
+        sx = _mm512_mask_add_ps(sx, is_disruptive, sx, _mm512_div_ps(dx, denominator));
+        sy = _mm512_mask_add_ps(sy, is_disruptive, sy, _mm512_div_ps(dy, denominator));
+        ax = _mm512_mask_add_ps(ax, is_cohesive, ax, load16(source, source.vx, i, is_cohesive));
+        ay = _mm512_mask_add_ps(ay, is_cohesive, ay, load16(source, source.vy, i, is_cohesive));
+        cx = _mm512_mask_add_ps(cx, is_cohesive, cx, ox);
+        cy = _mm512_mask_add_ps(cy, is_cohesive, cy, oy);
+
+        disruptive += std::popcount(static_cast<uint32_t>(is_disruptive));
+        cohesive += std::popcount(static_cast<uint32_t>(is_cohesive));
+    }
+
+    return {
+        {_mm512_reduce_add_ps(sx), _mm512_reduce_add_ps(sy)},
+        {_mm512_reduce_add_ps(ax), _mm512_reduce_add_ps(ay)},
+        {_mm512_reduce_add_ps(cx), _mm512_reduce_add_ps(cy)},
+        disruptive, cohesive
+    };
+}
+#endif
+
+template<typename Source>
+static constexpr std::array<Kernel<Source>, 4> Kernels {
+#ifdef FLOX_X86
+    scalar_kernel<Source>, sse4_kernel<Source>, avx2_kernel<Source>, avx512_kernel<Source>
+#else
+    scalar_kernel<Source>, scalar_kernel<Source>, scalar_kernel<Source>, scalar_kernel<Source>
+#endif
+};
+
+SimdLevel detected_simd_level() {
+#if defined(FLOX_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE4;
+    }
+#elif defined(FLOX_X86) && defined(_MSC_VER)
+    int registers[4];
+    __cpuid(registers, 1);
+    const bool sse4 = registers[2] & (1 << 19);
+    const bool os_saves_ymm = (registers[2] & (1 << 27)) && (_xgetbv(0) & 0x06) == 0x06;
+
+    __cpuidex(registers, 7, 0);
+    const bool avx2 = os_saves_ymm && (registers[1] & (1 << 5));
+    const bool avx512 = avx2 && (registers[1] & (1 << 16)) && (_xgetbv(0) & 0xE6) == 0xE6;
+    if (avx512) {
+        return SimdLevel::AVX512;
+    } else if (avx2) {
+        return SimdLevel::AVX2;
+    } else if (sse4) {
+        return SimdLevel::SSE4;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+static SimdLevel s_level {detected_simd_level()};
+
+void set_simd_level(const SimdLevel level) {
+    s_level = std::min(level, detected_simd_level());
+}
+
+SimdLevel simd_level() {
+    return s_level;
+}
+
+NeighborSums accumulate_neighbors(
+    const Vector position, Neighbors const &neighbors, const float disruptive_radius, const float cohesive_radius
+) {
+    const PackedSource source {
+        neighbors.x.data(), neighbors.y.data(), neighbors.vx.data(), neighbors.vy.data(), neighbors.size()
+    };
+    return Kernels<PackedSource>[static_cast<size_t>(s_level)](position, source, disruptive_radius, cohesive_radius);
+}
+
+NeighborSums accumulate_neighbors(
+    const Vector position, BoidStore const &boids, const std::span<const uint32_t> indices,
+    const float disruptive_radius, const float cohesive_radius
+) {
+    const IndexedSource source {boids.x(), boids.y(), boids.vx(), boids.vy(), indices.data(), indices.size()};
+    return Kernels<IndexedSource>[static_cast<size_t>(s_level)](
+        position, source, disruptive_radius, cohesive_radius
+    );
+}
+
+NeighborSums accumulate_neighbors(
+    const Vector position, BoidStore const &boids, const std::span<const uint32_t> indices,
+    const std::span<const float> distances, const float disruptive_radius, const float cohesive_radius
+) {
+    const MeasuredSource source {
+        {boids.x(), boids.y(), boids.vx(), boids.vy(), indices.data(), indices.size()}, distances.data()
+    };
+    return Kernels<MeasuredSource>[static_cast<size_t>(s_level)](
+        position, source, disruptive_radius, cohesive_radius
+    );
+}
+
+
+// Each point is written to the next free slot and the slot only kept if the point is inside, so there is no branch.
+static size_t select_scalar(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected
+) {
+    const float left = area.center.x - area.size.x;
+    const float right = area.center.x + area.size.x;
+    const float bottom = area.center.y - area.size.y;
+    const float top = area.center.y + area.size.y;
+
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const bool outside = (xs[i] < left) | (xs[i] > right) | (ys[i] < bottom) | (ys[i] > top) | (indices[i] == skip);
+        selected[found] = indices[i];
+        found += !outside;
+    }
+
+    return found;
+}
+
+static size_t select_radius_scalar(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected, float *distances
+) {
+    const float radius2 = area.radius * area.radius;
+
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const float d2 = glm::distance2(area.center, Vector {xs[i], ys[i]});
+        selected[found] = indices[i];
+        distances[found] = d2;
+        found += (d2 < radius2) & (indices[i] != skip);
+    }
+
+    return found;
+}
+
+#ifdef FLOX_X86
+// Vector kernels compare every lane at once, then pack the lanes that passed to the front. SSE and AVX2 have no
+//   compress instruction, so they shuffle with a table entry for each mask of passing lanes.
+template<size_t Lanes, size_t LaneBytes>
+static constexpr auto compress_table() {
+    std::array<std::array<uint8_t, Lanes * LaneBytes>, 1 << Lanes> table {};
+    for (size_t mask = 0; mask < table.size(); ++mask) {
+        size_t to = 0;
+        for (size_t lane = 0; lane < Lanes; ++lane) {
+            if (mask & (1 << lane)) {
+                for (size_t byte = 0; byte < LaneBytes; ++byte) {
+                    table[mask][to * LaneBytes + byte] = static_cast<uint8_t>(lane * LaneBytes + byte);
+                }
+
+                ++to;
+            }
+        }
+    }
+
+    return table;
+}
+
+// pshufb byte indices for 4 lanes of 4 bytes, and vpermd lane indices for 8 lanes, widened from bytes on load.
+alignas(16) static constexpr auto Compress4 = compress_table<4, 4>();
+alignas(8) static constexpr auto Compress8 = compress_table<8, 1>();
+
+FLOX_TARGET("sse4.1") static size_t select_sse4(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected
+) {
+    const __m128 left = _mm_set1_ps(area.center.x - area.size.x);
+    const __m128 right = _mm_set1_ps(area.center.x + area.size.x);
+    const __m128 bottom = _mm_set1_ps(area.center.y - area.size.y);
+    const __m128 top = _mm_set1_ps(area.center.y + area.size.y);
+    const __m128i skipped = _mm_set1_epi32(static_cast<int>(skip));
+    const uint32_t valid = (1u << count) - 1;
+
+    size_t found = 0;
+    for (size_t half = 0; half < SelectWidth; half += 4) {
+        const __m128 x = _mm_loadu_ps(xs + half);
+        const __m128 y = _mm_loadu_ps(ys + half);
+        const __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices + half));
+
+        __m128 outside = _mm_or_ps(_mm_cmplt_ps(x, left), _mm_cmpgt_ps(x, right));
+        outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmplt_ps(y, bottom), _mm_cmpgt_ps(y, top)));
+        outside = _mm_or_ps(outside, _mm_castsi128_ps(_mm_cmpeq_epi32(index, skipped)));
+
+        const uint32_t inside = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & valid >> half & 0xF;
+        const __m128i order = _mm_load_si128(reinterpret_cast<const __m128i *>(Compress4[inside].data()));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(selected + found), _mm_shuffle_epi8(index, order));
+        found += std::popcount(inside);
+    }
+
+    return found;
+}
+
+FLOX_TARGET("sse4.1") static size_t select_radius_sse4(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected, float *distances
+) {
+    const __m128 cx = _mm_set1_ps(area.center.x);
+    const __m128 cy = _mm_set1_ps(area.center.y);
+    const __m128 radius2 = _mm_set1_ps(area.radius * area.radius);
+    const __m128i skipped = _mm_set1_epi32(static_cast<int>(skip));
+    const uint32_t valid = (1u << count) - 1;
+
+    size_t found = 0;
+    for (size_t half = 0; half < SelectWidth; half += 4) {
+        const __m128 dx = _mm_sub_ps(cx, _mm_loadu_ps(xs + half));
+        const __m128 dy = _mm_sub_ps(cy, _mm_loadu_ps(ys + half));
+        const __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        const __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices + half));
+
+        const __m128 outside = _mm_or_ps(_mm_cmpnlt_ps(d2, radius2), _mm_castsi128_ps(_mm_cmpeq_epi32(index, skipped)));
+        const uint32_t inside = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & valid >> half & 0xF;
+        const __m128i order = _mm_load_si128(reinterpret_cast<const __m128i *>(Compress4[inside].data()));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(selected + found), _mm_shuffle_epi8(index, order));
+        _mm_storeu_ps(distances + found, _mm_castsi128_ps(_mm_shuffle_epi8(_mm_castps_si128(d2), order)));
+        found += std::popcount(inside);
+    }
+
+    return found;
+}
+
+FLOX_TARGET("avx2") static size_t select_avx2(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected
+) {
+    const __m256 x = _mm256_loadu_ps(xs);
+    const __m256 y = _mm256_loadu_ps(ys);
+    const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indices));
+
+    __m256 outside = _mm256_or_ps(
+        _mm256_cmp_ps(x, _mm256_set1_ps(area.center.x - area.size.x), _CMP_LT_OQ),
+        _mm256_cmp_ps(x, _mm256_set1_ps(area.center.x + area.size.x), _CMP_GT_OQ)
+    );
+    outside = _mm256_or_ps(outside, _mm256_or_ps(
+        _mm256_cmp_ps(y, _mm256_set1_ps(area.center.y - area.size.y), _CMP_LT_OQ),
+        _mm256_cmp_ps(y, _mm256_set1_ps(area.center.y + area.size.y), _CMP_GT_OQ)
+    ));
+    outside = _mm256_or_ps(outside, _mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(index, _mm256_set1_epi32(static_cast<int>(skip)))
+    ));
+
+    const uint32_t inside = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & ((1u << count) - 1);
+    const __m256i order = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(Compress8[inside].data()))
+    );
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(selected), _mm256_permutevar8x32_epi32(index, order));
+    return std::popcount(inside);
+}
+
+FLOX_TARGET("avx2") static size_t select_radius_avx2(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected, float *distances
+) {
+    const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(area.center.x), _mm256_loadu_ps(xs));
+    const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(area.center.y), _mm256_loadu_ps(ys));
+    const __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indices));
+
+    const __m256 outside = _mm256_or_ps(
+        _mm256_cmp_ps(d2, _mm256_set1_ps(area.radius * area.radius), _CMP_NLT_UQ),
+        _mm256_castsi256_ps(_mm256_cmpeq_epi32(index, _mm256_set1_epi32(static_cast<int>(skip))))
+    );
+
+    const uint32_t inside = ~static_cast<uint32_t>(_mm256_movemask_ps(outside)) & ((1u << count) - 1);
+    const __m256i order = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(Compress8[inside].data()))
+    );
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(selected), _mm256_permutevar8x32_epi32(index, order));
+    _mm256_storeu_ps(distances, _mm256_permutevar8x32_ps(d2, order));
+    return std::popcount(inside);
+}
+
+// Runs in the low half of a 16 lane register, so it needs nothing past AVX-512F. Lanes past count are never loaded.
+FLOX_TARGET("avx512f") static size_t select_avx512(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected
+) {
+    const auto valid = static_cast<__mmask16>((1u << count) - 1);
+    const __m512 x = _mm512_maskz_loadu_ps(valid, xs);
+    const __m512 y = _mm512_maskz_loadu_ps(valid, ys);
+    const __m512i index = _mm512_maskz_loadu_epi32(valid, indices);
+
+    // Not less and not greater, so NaN counts as inside, as in Rectangle::contains.
+    __mmask16 inside = _mm512_mask_cmp_ps_mask(valid, x, _mm512_set1_ps(area.center.x - area.size.x), _CMP_NLT_UQ);
+    inside = _mm512_mask_cmp_ps_mask(inside, x, _mm512_set1_ps(area.center.x + area.size.x), _CMP_NGT_UQ);
+    inside = _mm512_mask_cmp_ps_mask(inside, y, _mm512_set1_ps(area.center.y - area.size.y), _CMP_NLT_UQ);
+    inside = _mm512_mask_cmp_ps_mask(inside, y, _mm512_set1_ps(area.center.y + area.size.y), _CMP_NGT_UQ);
+    inside = _mm512_mask_cmpneq_epi32_mask(inside, index, _mm512_set1_epi32(static_cast<int>(skip)));
+
+    // Compressed in a register and stored whole. Compressing straight to memory is microcoded on some CPUs.
+    const __m512i packed = _mm512_maskz_compress_epi32(inside, index);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(selected), _mm512_castsi512_si256(packed));
+    return std::popcount(static_cast<uint32_t>(inside));
+}
+
+FLOX_TARGET("avx512f") static size_t select_radius_avx512(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected, float *distances
+) {
+    const auto valid = static_cast<__mmask16>((1u << count) - 1);
+    const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(area.center.x), _mm512_maskz_loadu_ps(valid, xs));
+    const __m512 dy = _mm512_sub_ps(_mm512_set1_ps(area.center.y), _mm512_maskz_loadu_ps(valid, ys));
+    const __m512 d2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+    const __m512i index = _mm512_maskz_loadu_epi32(valid, indices);
+
+    __mmask16 inside = _mm512_mask_cmp_ps_mask(valid, d2, _mm512_set1_ps(area.radius * area.radius), _CMP_LT_OQ);
+    inside = _mm512_mask_cmpneq_epi32_mask(inside, index, _mm512_set1_epi32(static_cast<int>(skip)));
+
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(selected), _mm512_castsi512_si256(_mm512_maskz_compress_epi32(inside, index))
+    );
+    _mm256_storeu_ps(distances, _mm512_castps512_ps256(_mm512_maskz_compress_ps(inside, d2)));
+    return std::popcount(static_cast<uint32_t>(inside));
+}
+#endif
+
+using SelectKernel = size_t (*)(
+    Rectangle const &, float const *, float const *, uint32_t const *, size_t, uint32_t, uint32_t *
+);
+
+static constexpr std::array<SelectKernel, 4> SelectKernels {
+#ifdef FLOX_X86
+    select_scalar, select_sse4, select_avx2, select_avx512
+#else
+    select_scalar, select_scalar, select_scalar, select_scalar
+#endif
+};
+
+size_t select_in_area(
+    Rectangle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected
+) {
+    return SelectKernels[static_cast<size_t>(s_level)](area, xs, ys, indices, count, skip, selected);
+}
+
+using SelectRadiusKernel = size_t (*)(
+    Circle const &, float const *, float const *, uint32_t const *, size_t, uint32_t, uint32_t *, float *
+);
+
+static constexpr std::array<SelectRadiusKernel, 4> SelectRadiusKernels {
+#ifdef FLOX_X86
+    select_radius_scalar, select_radius_sse4, select_radius_avx2, select_radius_avx512
+#else
+    select_radius_scalar, select_radius_scalar, select_radius_scalar, select_radius_scalar
+#endif
+};
+
+size_t select_in_radius(
+    Circle const &area, float const *xs, float const *ys, uint32_t const *indices, const size_t count,
+    const uint32_t skip, uint32_t *selected, float *distances
+) {
+    return SelectRadiusKernels[static_cast<size_t>(s_level)](
+        area, xs, ys, indices, count, skip, selected, distances
+    );
+}
+
+
+static void steer_scalar(
+    SteeringBlock const &block, const size_t count, BoidStore const &read, BoidStore &write, const size_t first,
+    const Rectangle center_bound, const Rectangle hard_bound, const float delta
+) {
+    for (size_t lane = 0; lane < count; ++lane) {
+        const size_t i = first + lane;
+        const Boid current = read.boid(i);
+
+        Vector center_steer {0.0f, 0.0f};
+        float center_steer_weight = Boid::primadonnaWeight;
+        if (!center_bound.contains(current.position)) {
+            if (!hard_bound.contains(current.position)) {
+                center_steer_weight *= 2.0f;
+            }
+
+            center_steer -= current.position;
+            center_steer = steer(center_steer, current.velocity);
+        }
+
+        const Vector full_speed = steer(current.velocity, current.velocity);
+
+        Vector separation {block.separation_x[lane], block.separation_y[lane]};
+        Vector alignment {block.alignment_x[lane], block.alignment_y[lane]};
+        Vector cohesion {block.cohesion_x[lane], block.cohesion_y[lane]};
+
+        if (block.disruptive[lane] > 0.0f) {
+            separation /= block.disruptive[lane];
+            separation = steer(separation, current.velocity);
+        }
+
+        if (block.cohesive[lane] > 0.0f) {
+            const float countFactor = 1.0f / block.cohesive[lane];
+            alignment *= countFactor;
+
+            cohesion *= countFactor;
+            cohesion -= current.position;
+
+            alignment = steer(alignment, current.velocity);
+            cohesion = steer(cohesion, current.velocity);
+        }
+
+        const Vector acceleration = magnitude(
+            Vector{center_steer * center_steer_weight + full_speed * Boid::speedWeight +
+                   separation * Boid::separationWeight + alignment * Boid::alignmentWeight +
+                   cohesion * Boid::cohesionWeight},
+            Boid::maxForce);
+
+        write.set_velocity(i, current.velocity + acceleration);
+        write.set_position(i, current.position + current.velocity * delta);
+    }
+}
+
+#ifdef FLOX_X86
+// Batch versions of the helpers in Boid, one boid per lane. The hardware estimate is good to about 12 bits and one
+//   Newton-Raphson step brings it close to full precision. Zero vectors stay zero, as with fastInverseSqrt.
+struct Lanes8 {
+    __m256 x, y;
+};
+
+FLOX_INLINE_TARGET("avx2") static __m256 inverse_sqrt(__m256 d) {
+    d = _mm256_max_ps(d, _mm256_set1_ps(std::numeric_limits<float>::min()));
+    const __m256 y = _mm256_rsqrt_ps(d);
+    const __m256 half_d_y2 = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), d), _mm256_mul_ps(y, y));
+    return _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), half_d_y2));
+}
+
+FLOX_INLINE_TARGET("avx2") static __m256 length2(const Lanes8 v) {
+    return _mm256_add_ps(_mm256_mul_ps(v.x, v.x), _mm256_mul_ps(v.y, v.y));
+}
+
+FLOX_INLINE_TARGET("avx2") static Lanes8 scale(const Lanes8 v, const __m256 s) {
+    return {_mm256_mul_ps(v.x, s), _mm256_mul_ps(v.y, s)};
+}
+
+FLOX_INLINE_TARGET("avx2") static Lanes8 magnitude(const Lanes8 v, const __m256 mag) {
+    return scale(v, _mm256_mul_ps(inverse_sqrt(length2(v)), mag));
+}
+
+FLOX_INLINE_TARGET("avx2") static Lanes8 truncate(const Lanes8 v, const __m256 max) {
+    return scale(v, _mm256_min_ps(_mm256_mul_ps(max, inverse_sqrt(length2(v))), _mm256_set1_ps(1.0f)));
+}
+
+FLOX_INLINE_TARGET("avx2") static Lanes8 steer(
+    const Lanes8 v, const Lanes8 velocity, const __m256 max_speed, const __m256 max_force
+) {
+    const Lanes8 desired = magnitude(v, max_speed);
+    return truncate({_mm256_sub_ps(desired.x, velocity.x), _mm256_sub_ps(desired.y, velocity.y)}, max_force);
+}
+
+// Keeps a where mask is set and zeroes the other lanes.
+FLOX_INLINE_TARGET("avx2") static Lanes8 select(const __m256 mask, const Lanes8 a) {
+    return {_mm256_and_ps(mask, a.x), _mm256_and_ps(mask, a.y)};
+}
+
+FLOX_INLINE_TARGET("avx2") static void add_weighted(Lanes8 &sum, const Lanes8 v, const __m256 weight) {
+    sum.x = _mm256_add_ps(sum.x, _mm256_mul_ps(v.x, weight));
+    sum.y = _mm256_add_ps(sum.y, _mm256_mul_ps(v.y, weight));
+}
+
+FLOX_INLINE_TARGET("avx2") static __m256 outside(const Lanes8 p, const Rectangle bound) {
+    const __m256 low_x = _mm256_cmp_ps(p.x, _mm256_set1_ps(bound.center.x - bound.size.x), _CMP_LT_OQ);
+    const __m256 high_x = _mm256_cmp_ps(p.x, _mm256_set1_ps(bound.center.x + bound.size.x), _CMP_GT_OQ);
+    const __m256 low_y = _mm256_cmp_ps(p.y, _mm256_set1_ps(bound.center.y - bound.size.y), _CMP_LT_OQ);
+    const __m256 high_y = _mm256_cmp_ps(p.y, _mm256_set1_ps(bound.center.y + bound.size.y), _CMP_GT_OQ);
+    return _mm256_or_ps(_mm256_or_ps(low_x, high_x), _mm256_or_ps(low_y, high_y));
+}
+
+FLOX_TARGET("avx2") static void steer_avx2(
+    SteeringBlock const &block, const size_t count, BoidStore const &read, BoidStore &write, const size_t first,
+    const Rectangle center_bound, const Rectangle hard_bound, const float delta
+) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 max_speed = _mm256_set1_ps(Boid::maxSpeed);
+    const __m256 max_force = _mm256_set1_ps(Boid::maxForce);
+    const __m256 timestep = _mm256_set1_ps(delta);
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (size_t lane = 0; lane < count; lane += 8) {
+        // Lanes past count belong to another thread's boids, so they are neither read nor written.
+        const __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count - lane)), lane_index);
+        const size_t i = first + lane;
+        const Lanes8 position {_mm256_maskload_ps(read.x() + i, active), _mm256_maskload_ps(read.y() + i, active)};
+        const Lanes8 velocity {_mm256_maskload_ps(read.vx() + i, active), _mm256_maskload_ps(read.vy() + i, active)};
+
+        const __m256 outside_center = outside(position, center_bound);
+        const __m256 outside_hard = outside(position, hard_bound);
+        const Lanes8 to_center {_mm256_sub_ps(zero, position.x), _mm256_sub_ps(zero, position.y)};
+        const Lanes8 center_steer = select(outside_center, steer(to_center, velocity, max_speed, max_force));
+        const __m256 center_weight = _mm256_blendv_ps(
+            _mm256_set1_ps(Boid::primadonnaWeight), _mm256_set1_ps(2.0f * Boid::primadonnaWeight), outside_hard
+        );
+
+        const Lanes8 full_speed = steer(velocity, velocity, max_speed, max_force);
+
+        const __m256 disruptive = _mm256_load_ps(block.disruptive.data() + lane);
+        const Lanes8 separation_sum {
+            _mm256_load_ps(block.separation_x.data() + lane), _mm256_load_ps(block.separation_y.data() + lane)
+        };
+        const __m256 separation_factor = _mm256_div_ps(one, _mm256_max_ps(disruptive, one));
+        const Lanes8 separation = select(
+            _mm256_cmp_ps(disruptive, zero, _CMP_GT_OQ),
+            steer(scale(separation_sum, separation_factor), velocity, max_speed, max_force)
+        );
+
+        const __m256 cohesive = _mm256_load_ps(block.cohesive.data() + lane);
+        const __m256 has_cohesive = _mm256_cmp_ps(cohesive, zero, _CMP_GT_OQ);
+        const __m256 count_factor = _mm256_div_ps(one, _mm256_max_ps(cohesive, one));
+        const Lanes8 alignment_sum {
+            _mm256_load_ps(block.alignment_x.data() + lane), _mm256_load_ps(block.alignment_y.data() + lane)
+        };
+        const Lanes8 alignment = select(
+            has_cohesive, steer(scale(alignment_sum, count_factor), velocity, max_speed, max_force)
+        );
+
+        const Lanes8 cohesion_sum {
+            _mm256_load_ps(block.cohesion_x.data() + lane), _mm256_load_ps(block.cohesion_y.data() + lane)
+        };
+        const Lanes8 cohesion_average = scale(cohesion_sum, count_factor);
+        const Lanes8 to_cohesion {
+            _mm256_sub_ps(cohesion_average.x, position.x), _mm256_sub_ps(cohesion_average.y, position.y)
+        };
+        const Lanes8 cohesion = select(has_cohesive, steer(to_cohesion, velocity, max_speed, max_force));
+
+        Lanes8 acceleration {zero, zero};
+        add_weighted(acceleration, center_steer, center_weight);
+        add_weighted(acceleration, full_speed, _mm256_set1_ps(Boid::speedWeight));
+        add_weighted(acceleration, separation, _mm256_set1_ps(Boid::separationWeight));
+        add_weighted(acceleration, alignment, _mm256_set1_ps(Boid::alignmentWeight));
+        add_weighted(acceleration, cohesion, _mm256_set1_ps(Boid::cohesionWeight));
+        acceleration = magnitude(acceleration, max_force);
+
+        const Lanes8 step = scale(velocity, timestep);
+        _mm256_maskstore_ps(write.vx() + i, active, _mm256_add_ps(velocity.x, acceleration.x));
+        _mm256_maskstore_ps(write.vy() + i, active, _mm256_add_ps(velocity.y, acceleration.y));
+        _mm256_maskstore_ps(write.x() + i, active, _mm256_add_ps(position.x, step.x));
+        _mm256_maskstore_ps(write.y() + i, active, _mm256_add_ps(position.y, step.y));
+    }
+
+    _mm256_zeroupper();
+}
+
+struct Lanes16 {
+    __m512 x, y;
+};
+
+FLOX_INLINE_TARGET("avx512f") static __m512 inverse_sqrt(__m512 d) {
+    // rsqrt14 is already good to 14 bits, the Newton step takes it the rest of the way.
+    d = _mm512_max_ps(d, _mm512_set1_ps(std::numeric_limits<float>::min()));
+    const __m512 y = _mm512_rsqrt14_ps(d);
+    const __m512 half_d_y2 = _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), d), _mm512_mul_ps(y, y));
+    return _mm512_mul_ps(y, _mm512_sub_ps(_mm512_set1_ps(1.5f), half_d_y2));
+}
+
+FLOX_INLINE_TARGET("avx512f") static __m512 length2(const Lanes16 v) {
+    return _mm512_add_ps(_mm512_mul_ps(v.x, v.x), _mm512_mul_ps(v.y, v.y));
+}
+
+FLOX_INLINE_TARGET("avx512f") static Lanes16 scale(const Lanes16 v, const __m512 s) {
+    return {_mm512_mul_ps(v.x, s), _mm512_mul_ps(v.y, s)};
+}
+
+FLOX_INLINE_TARGET("avx512f") static Lanes16 magnitude(const Lanes16 v, const __m512 mag) {
+    return scale(v, _mm512_mul_ps(inverse_sqrt(length2(v)), mag));
+}
+
+FLOX_INLINE_TARGET("avx512f") static Lanes16 truncate(const Lanes16 v, const __m512 max) {
+    return scale(v, _mm512_min_ps(_mm512_mul_ps(max, inverse_sqrt(length2(v))), _mm512_set1_ps(1.0f)));
+}
+
+FLOX_INLINE_TARGET("avx512f") static Lanes16 steer(
+    const Lanes16 v, const Lanes16 velocity, const __m512 max_speed, const __m512 max_force
+) {
+    const Lanes16 desired = magnitude(v, max_speed);
+    return truncate({_mm512_sub_ps(desired.x, velocity.x), _mm512_sub_ps(desired.y, velocity.y)}, max_force);
+}
+
+FLOX_INLINE_TARGET("avx512f") static Lanes16 select(const __mmask16 mask, const Lanes16 a) {
+    return {_mm512_maskz_mov_ps(mask, a.x), _mm512_maskz_mov_ps(mask, a.y)};
+}
+
+FLOX_INLINE_TARGET("avx512f") static void add_weighted(Lanes16 &sum, const Lanes16 v, const __m512 weight) {
+    sum.x = _mm512_add_ps(sum.x, _mm512_mul_ps(v.x, weight));
+    sum.y = _mm512_add_ps(sum.y, _mm512_mul_ps(v.y, weight));
+}
+
+FLOX_INLINE_TARGET("avx512f") static __mmask16 outside(const Lanes16 p, const Rectangle bound) {
+    return _mm512_cmp_ps_mask(p.x, _mm512_set1_ps(bound.center.x - bound.size.x), _CMP_LT_OQ)
+           | _mm512_cmp_ps_mask(p.x, _mm512_set1_ps(bound.center.x + bound.size.x), _CMP_GT_OQ)
+           | _mm512_cmp_ps_mask(p.y, _mm512_set1_ps(bound.center.y - bound.size.y), _CMP_LT_OQ)
+           | _mm512_cmp_ps_mask(p.y, _mm512_set1_ps(bound.center.y + bound.size.y), _CMP_GT_OQ);
+}
+
+// A block is exactly one iteration.
+FLOX_TARGET("avx512f") static void steer_avx512(
+    SteeringBlock const &block, const size_t count, BoidStore const &read, BoidStore &write, const size_t first,
+    const Rectangle center_bound, const Rectangle hard_bound, const float delta
+) {
+    static_assert(SteeringBlock::Capacity == 16);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 max_speed = _mm512_set1_ps(Boid::maxSpeed);
+    const __m512 max_force = _mm512_set1_ps(Boid::maxForce);
+
+    // Lanes past count belong to another thread's boids, so they are neither read nor written.
+    const auto active = static_cast<__mmask16>(count >= 16 ? 0xFFFF : (1u << count) - 1);
+    const Lanes16 position {
+        _mm512_maskz_loadu_ps(active, read.x() + first), _mm512_maskz_loadu_ps(active, read.y() + first)
+    };
+    const Lanes16 velocity {
+        _mm512_maskz_loadu_ps(active, read.vx() + first), _mm512_maskz_loadu_ps(active, read.vy() + first)
+    };
+
+    const __mmask16 outside_center = outside(position, center_bound);
+    const __mmask16 outside_hard = outside(position, hard_bound);
+    const Lanes16 to_center {_mm512_sub_ps(zero, position.x), _mm512_sub_ps(zero, position.y)};
+    const Lanes16 center_steer = select(outside_center, steer(to_center, velocity, max_speed, max_force));
+    const __m512 center_weight = _mm512_mask_mov_ps(
+        _mm512_set1_ps(Boid::primadonnaWeight), outside_hard, _mm512_set1_ps(2.0f * Boid::primadonnaWeight)
+    );
+
+    const Lanes16 full_speed = steer(velocity, velocity, max_speed, max_force);
+
+    const __m512 disruptive = _mm512_load_ps(block.disruptive.data());
+    const Lanes16 separation_sum {_mm512_load_ps(block.separation_x.data()), _mm512_load_ps(block.separation_y.data())};
+    const Lanes16 separation = select(
+        _mm512_cmp_ps_mask(disruptive, zero, _CMP_GT_OQ),
+        steer(scale(separation_sum, _mm512_div_ps(one, _mm512_max_ps(disruptive, one))), velocity, max_speed, max_force)
+    );
+
+    const __m512 cohesive = _mm512_load_ps(block.cohesive.data());
+    const __mmask16 has_cohesive = _mm512_cmp_ps_mask(cohesive, zero, _CMP_GT_OQ);
+    const __m512 count_factor = _mm512_div_ps(one, _mm512_max_ps(cohesive, one));
+    const Lanes16 alignment_sum {_mm512_load_ps(block.alignment_x.data()), _mm512_load_ps(block.alignment_y.data())};
+    const Lanes16 alignment = select(
+        has_cohesive, steer(scale(alignment_sum, count_factor), velocity, max_speed, max_force)
+    );
+
+    const Lanes16 cohesion_sum {_mm512_load_ps(block.cohesion_x.data()), _mm512_load_ps(block.cohesion_y.data())};
+    const Lanes16 cohesion_average = scale(cohesion_sum, count_factor);
+    const Lanes16 to_cohesion {
+        _mm512_sub_ps(cohesion_average.x, position.x), _mm512_sub_ps(cohesion_average.y, position.y)
+    };
+    const Lanes16 cohesion = select(has_cohesive, steer(to_cohesion, velocity, max_speed, max_force));
+
+    Lanes16 acceleration {zero, zero};
+    add_weighted(acceleration, center_steer, center_weight);
+    add_weighted(acceleration, full_speed, _mm512_set1_ps(Boid::speedWeight));
+    add_weighted(acceleration, separation, _mm512_set1_ps(Boid::separationWeight));
+    add_weighted(acceleration, alignment, _mm512_set1_ps(Boid::alignmentWeight));
+    add_weighted(acceleration, cohesion, _mm512_set1_ps(Boid::cohesionWeight));
+    acceleration = magnitude(acceleration, max_force);
+
+    const Lanes16 step = scale(velocity, _mm512_set1_ps(delta));
+    _mm512_mask_storeu_ps(write.vx() + first, active, _mm512_add_ps(velocity.x, acceleration.x));
+    _mm512_mask_storeu_ps(write.vy() + first, active, _mm512_add_ps(velocity.y, acceleration.y));
+    _mm512_mask_storeu_ps(write.x() + first, active, _mm512_add_ps(position.x, step.x));
+    _mm512_mask_storeu_ps(write.y() + first, active, _mm512_add_ps(position.y, step.y));
+}
+#endif
+
+using SteeringKernel = void (*)(
+    SteeringBlock const &, size_t, BoidStore const &, BoidStore &, size_t, Rectangle, Rectangle, float
+);
+
+// Only the 8 and 16 lane levels have a vector tail. SSE keeps the scalar one.
+static constexpr std::array<SteeringKernel, 4> SteeringKernels {
+#ifdef FLOX_X86
+    steer_scalar, steer_scalar, steer_avx2, steer_avx512
+#else
+    steer_scalar, steer_scalar, steer_scalar, steer_scalar
+#endif
+};
+
+void steer_block(
+    SteeringBlock const &block, const size_t count, BoidStore const &read, BoidStore &write, const size_t first,
+    const Rectangle center_bound, const Rectangle hard_bound, const float delta
+) {
+    SteeringKernels[static_cast<size_t>(s_level)](
+        block, count, read, write, first, center_bound, hard_bound, delta
+    );
+}
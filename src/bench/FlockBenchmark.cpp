@@ -0,0 +1,231 @@
+#include "pch.hpp"
+#include "Core/Window/Window.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+import Algorithm;
+import DirectComputeAlgorithm;
+import DirectLoopAlgorithm;
+import Flock;
+import GridAlgorithm;
+import QuadtreeAlgorithm;
+import Rectangle;
+import ThreadedAlgorithm;
+
+using namespace std::chrono;
+
+
+template<class Clock>
+static inline double delta(time_point<Clock> start) {
+    return 0.000000001 * static_cast<double>(duration_cast<nanoseconds>(
+        high_resolution_clock::now() - start
+    ).count());
+}
+
+
+struct Options {
+    size_t min_count = 1024;
+    size_t max_count = 4 * 1024 * 1024;
+    size_t direct_max_count = 16 * 1024;  // The direct algorithms are O(n^2).
+    int steps = 100;
+    int warmup = 10;
+    int max_threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    double budget = 30.0;  // Seconds per configuration before cutting the step count short.
+    bool csv = false;
+    bool gpu = false;
+    std::vector<std::string> algorithms {"threaded", "grid", "quadtree", "direct"};
+};
+
+
+struct Result {
+    double median;
+    double p95;
+    double p99;
+    int steps;
+};
+
+// Nearest-rank percentile over an already sorted list of step times.
+static double percentile(std::vector<double> const &sorted, const double p) {
+    const auto rank = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+static Result measure(Algorithm *algorithm, const size_t count, Options const &options) {
+    constexpr float dt = 1.0f / 60.0f;
+    Flock flock {count};
+
+    for (int i = 0; i < options.warmup; ++i) {
+        flock.update(algorithm, dt);
+    }
+
+    std::vector<double> times;
+    times.reserve(options.steps);
+    double total = 0.0;
+    for (int i = 0; i < options.steps; ++i) {
+        const auto start = high_resolution_clock::now();
+        flock.update(algorithm, dt);
+        const double step = delta(start);
+        times.push_back(step);
+
+        // Large flocks on slow algorithms would otherwise take hours. Keep enough samples for a p99 to mean something.
+        total += step;
+        if (total > options.budget && times.size() >= 10) {
+            break;
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    return {percentile(times, 0.5), percentile(times, 0.95), percentile(times, 0.99), static_cast<int>(times.size())};
+}
+
+static void report(
+    Options const &options, const char *algorithm, const int threads, const size_t count, Result const &result
+) {
+    const double updates = static_cast<double>(count) / result.median;
+    if (options.csv) {
+        std::cout << algorithm << ',' << threads << ',' << count << ',' << result.steps << ','
+                  << result.median * 1000.0 << ',' << result.p95 * 1000.0 << ',' << result.p99 * 1000.0 << ','
+                  << updates << std::endl;
+        return;
+    }
+
+    std::cout << std::left << std::setw(10) << algorithm
+              << std::right << std::setw(8) << threads
+              << std::setw(10) << count
+              << std::setw(7) << result.steps
+              << std::fixed << std::setprecision(3)
+              << std::setw(12) << result.median * 1000.0
+              << std::setw(12) << result.p95 * 1000.0
+              << std::setw(12) << result.p99 * 1000.0
+              << std::setw(16) << std::setprecision(0) << updates
+              << std::endl;
+}
+
+static Vector bounds_for(const size_t count) {
+    // Flock lays boids out in a spiral with radius 7.5 * sqrt(n). Keep the world at least as large as that.
+    return Vector {std::max(500.0f, 7.5f * glm::sqrt(static_cast<float>(count)))};
+}
+
+static std::vector<int> thread_counts(const int max_threads) {
+    std::vector<int> counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+
+// Options:
+//   --min <count>          Smallest flock. Defaults to 1024.
+//   --max <count>          Largest flock. Defaults to 4194304. Flock sizes step by a factor of 4.
+//   --direct-max <count>   Largest flock run through the O(n^2) direct and compute algorithms.
+//   --steps <count>        Measured steps per configuration.
+//   --warmup <count>       Unmeasured steps before measuring.
+//   --threads <count>      Largest thread count for the threaded and grid algorithms. Runs 1, 2, 4, ... up to this.
+//   --budget <seconds>     Time limit per configuration.
+//   --algorithms <list>    Comma-separated subset of threaded,grid,quadtree,direct,compute.
+//   --gpu                  Create a window for an OpenGL context and add the compute algorithm.
+//   --csv                  Print comma-separated values.
+int main(int argc, char *argv[]) {
+    Options options {};
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument {argv[i]};
+        const bool has_value = i + 1 < argc;
+        if (argument == "--min" && has_value) {
+            options.min_count = std::max<size_t>(std::stoull(argv[++i]), 1);
+        } else if (argument == "--max" && has_value) {
+            options.max_count = std::stoull(argv[++i]);
+        } else if (argument == "--direct-max" && has_value) {
+            options.direct_max_count = std::stoull(argv[++i]);
+        } else if (argument == "--steps" && has_value) {
+            options.steps = std::max(std::stoi(argv[++i]), 1);
+        } else if (argument == "--warmup" && has_value) {
+            options.warmup = std::stoi(argv[++i]);
+        } else if (argument == "--threads" && has_value) {
+            options.max_threads = std::max(std::stoi(argv[++i]), 1);
+        } else if (argument == "--budget" && has_value) {
+            options.budget = std::stod(argv[++i]);
+        } else if (argument == "--algorithms" && has_value) {
+            options.algorithms.clear();
+            std::stringstream list {argv[++i]};
+            for (std::string name; std::getline(list, name, ',');) {
+                options.algorithms.push_back(name);
+            }
+        } else if (argument == "--gpu") {
+            options.gpu = true;
+        } else if (argument == "--csv") {
+            options.csv = true;
+        } else {
+            std::cerr << "Unknown argument: " << argument << '\n';
+            return -1;
+        }
+    }
+
+    const auto wants = [&options](const char *name) {
+        return std::find(options.algorithms.begin(), options.algorithms.end(), name) != options.algorithms.end();
+    };
+
+    if (options.gpu) {
+        window::Window &window {window::Window::get()};
+        window.create("Ultimate Flox Benchmark", window::Hints {320, 180, 0, window::Flags {false, true, false}});
+        if (!window.created()) {
+            std::cerr << "Unable to create an OpenGL context for the compute algorithm.\n";
+            return -1;
+        }
+
+        if (!wants("compute")) {
+            options.algorithms.emplace_back("compute");
+        }
+    }
+
+    if (options.csv) {
+        std::cout << "algorithm,threads,boids,steps,median_ms,p95_ms,p99_ms,boid_updates_per_s" << std::endl;
+    } else {
+        std::cout << std::left << std::setw(10) << "algorithm"
+                  << std::right << std::setw(8) << "threads"
+                  << std::setw(10) << "boids"
+                  << std::setw(7) << "steps"
+                  << std::setw(12) << "median ms"
+                  << std::setw(12) << "p95 ms"
+                  << std::setw(12) << "p99 ms"
+                  << std::setw(16) << "updates/s"
+                  << std::endl;
+    }
+
+    for (size_t count = options.min_count; count <= options.max_count; count *= 4) {
+        const Vector bounds {bounds_for(count)};
+
+        if (wants("threaded")) {
+            for (const int threads: thread_counts(options.max_threads)) {
+                ThreadedAlgorithm algorithm {bounds, threads};
+                report(options, algorithm.name(), threads, count, measure(&algorithm, count, options));
+            }
+        }
+
+        if (wants("grid")) {
+            for (const int threads: thread_counts(options.max_threads)) {
+                GridAlgorithm algorithm {bounds, threads};
+                report(options, algorithm.name(), threads, count, measure(&algorithm, count, options));
+            }
+        }
+
+        if (wants("quadtree")) {
+            QuadtreeAlgorithm algorithm {bounds};
+            report(options, algorithm.name(), 1, count, measure(&algorithm, count, options));
+        }
+
+        if (wants("direct") && count <= options.direct_max_count) {
+            DirectLoopAlgorithm algorithm {bounds};
+            report(options, algorithm.name(), 1, count, measure(&algorithm, count, options));
+        }
+
+        if (options.gpu && wants("compute") && count <= options.direct_max_count) {
+            DirectComputeAlgorithm algorithm {Rectangle {bounds}};
+            report(options, algorithm.name(), 0, count, measure(&algorithm, count, options));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,364 @@
+#include "pch.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <random>
+
+import Boid;
+import BoidStore;
+import Boidtree;
+import Quadtree;
+import Rectangle;
+
+using namespace std::chrono;
+
+
+// Every allocation made by the benchmark goes through here so the tree's per-frame allocations can be counted.
+// Quadtree buckets are over-aligned, so their vectors allocate through the align_val_t overloads, which the default
+//   library versions do not route through operator new(size_t). Those are replaced as well.
+static std::atomic<size_t> allocation_count {0};
+
+static void *counted_allocate(const std::size_t size) noexcept {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+static void *counted_allocate(const std::size_t size, const std::align_val_t alignment) noexcept {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    const auto align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc wants a size that is a multiple of the alignment.
+    return std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+#endif
+}
+
+static void aligned_free(void *memory) noexcept {
+#ifdef _MSC_VER
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+void *operator new(const std::size_t size) {
+    if (void *memory = counted_allocate(size)) {
+        return memory;
+    }
+
+    throw std::bad_alloc();
+}
+
+void *operator new(const std::size_t size, std::nothrow_t const &) noexcept {
+    return counted_allocate(size);
+}
+
+void *operator new(const std::size_t size, const std::align_val_t alignment) {
+    if (void *memory = counted_allocate(size, alignment)) {
+        return memory;
+    }
+
+    throw std::bad_alloc();
+}
+
+void *operator new(const std::size_t size, const std::align_val_t alignment, std::nothrow_t const &) noexcept {
+    return counted_allocate(size, alignment);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::nothrow_t const &) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    aligned_free(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+    aligned_free(memory);
+}
+
+void operator delete(void *memory, std::align_val_t, std::nothrow_t const &) noexcept {
+    aligned_free(memory);
+}
+
+
+template<class Clock>
+static inline double delta(time_point<Clock> start) {
+    return 0.000000001 * static_cast<double>(duration_cast<nanoseconds>(
+        high_resolution_clock::now() - start
+    ).count());
+}
+
+
+enum class Distribution {
+    Uniform,
+    Clustered,
+    Ring
+};
+
+constexpr std::array<Distribution, 3> Distributions {Distribution::Uniform, Distribution::Clustered, Distribution::Ring};
+
+static const char *distribution_name(const Distribution distribution) {
+    switch (distribution) {
+        case Distribution::Uniform: return "uniform";
+        case Distribution::Clustered: return "clustered";
+        case Distribution::Ring: return "ring";
+    }
+
+    return "unknown";
+}
+
+
+// Scale the world with the point count the same way Flock's starting spiral does, so density stays comparable.
+static Rectangle world_for(const size_t count) {
+    constexpr float spacing = 7.5f;
+    return Rectangle {Vector {spacing * glm::sqrt(static_cast<float>(count))}};
+}
+
+static std::vector<Vector> generate_points(
+    const Distribution distribution, const size_t count, const Rectangle bounds, const uint32_t seed
+) {
+    std::mt19937 generator {seed};
+    std::vector<Vector> points;
+    points.reserve(count);
+
+    const Vector low {bounds.center - bounds.size};
+    const Vector high {bounds.center + bounds.size};
+    const auto clamp_to_bounds = [low, high](const Vector p) {
+        return Vector {glm::clamp(p.x, low.x, high.x), glm::clamp(p.y, low.y, high.y)};
+    };
+
+    switch (distribution) {
+        case Distribution::Uniform: {
+            std::uniform_real_distribution<float> x {low.x, high.x};
+            std::uniform_real_distribution<float> y {low.y, high.y};
+            for (size_t i = 0; i < count; ++i) {
+                points.emplace_back(x(generator), y(generator));
+            }
+            break;
+        }
+        case Distribution::Clustered: {
+            // Tight flocks: a handful of dense gaussian blobs.
+            constexpr size_t cluster_count = 32;
+            std::uniform_real_distribution<float> x {low.x * 0.8f, high.x * 0.8f};
+            std::uniform_real_distribution<float> y {low.y * 0.8f, high.y * 0.8f};
+            std::array<Vector, cluster_count> centers;
+            for (Vector &center: centers) {
+                center = Vector {x(generator), y(generator)};
+            }
+
+            std::uniform_int_distribution<size_t> pick {0, cluster_count - 1};
+            std::normal_distribution<float> spread {0.0f, bounds.size.x * 0.02f};
+            for (size_t i = 0; i < count; ++i) {
+                const Vector center = centers[pick(generator)];
+                points.push_back(clamp_to_bounds(center + Vector {spread(generator), spread(generator)}));
+            }
+            break;
+        }
+        case Distribution::Ring: {
+            std::uniform_real_distribution<float> angle {0.0f, glm::two_pi<float>()};
+            std::normal_distribution<float> radius {bounds.size.x * 0.75f, bounds.size.x * 0.01f};
+            for (size_t i = 0; i < count; ++i) {
+                const float a = angle(generator);
+                const float r = radius(generator);
+                points.push_back(clamp_to_bounds(bounds.center + Vector {glm::cos(a) * r, glm::sin(a) * r}));
+            }
+            break;
+        }
+    }
+
+    return points;
+}
+
+
+struct Measurement {
+    const char *operation;
+    double seconds;
+    size_t operations;
+    size_t points;
+    double allocations_per_frame;
+};
+
+static void report(const Distribution distribution, const size_t count, Measurement const &m) {
+    std::cout << std::left << std::setw(12) << distribution_name(distribution)
+              << std::right << std::setw(10) << count << "  "
+              << std::left << std::setw(16) << m.operation
+              << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << 1.0e9 * m.seconds / static_cast<double>(std::max<size_t>(m.operations, 1))
+              << std::setw(16) << std::setprecision(0) << static_cast<double>(m.points) / m.seconds
+              << std::setw(14) << std::setprecision(2) << m.allocations_per_frame
+              << '\n';
+}
+
+
+static void run_distribution(const Distribution distribution, const size_t count, const uint32_t seed) {
+    const Rectangle bounds {world_for(count)};
+    const std::vector<Vector> points {generate_points(distribution, count, bounds, seed)};
+
+    // Repeat small trees enough times to get a stable number, but always do at least a few frames.
+    const size_t frames = std::clamp<size_t>(4'000'000 / count, 3, 200);
+    const size_t query_stride = std::max<size_t>(count / 200'000, 1);
+    const Rectangle query_template {Vector {Boid::cohesiveRadius}};
+
+    // ****** Insert / Clear ******
+    Quadtree<ptrdiff_t> tree {bounds};
+    double insert_seconds = 0.0;
+    double clear_seconds = 0.0;
+    size_t steady_allocations = 0;
+    for (size_t frame = 0; frame < frames; ++frame) {
+        const size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+
+        auto start = high_resolution_clock::now();
+        tree.clear();
+        clear_seconds += delta(start);
+
+        start = high_resolution_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            tree.insert(static_cast<ptrdiff_t>(i), points[i]);
+        }
+        insert_seconds += delta(start);
+
+        // The first frame grows the tree's vectors from nothing. Every frame after shows the steady state.
+        if (frame > 0) {
+            steady_allocations += allocation_count.load(std::memory_order_relaxed) - allocations_before;
+        }
+    }
+
+    const auto steady_frames = static_cast<double>(frames - 1);
+    const double frame_allocations = static_cast<double>(steady_allocations) / steady_frames;
+    report(distribution, count, {"insert", insert_seconds, frames * count, frames * count, frame_allocations});
+    report(distribution, count, {"clear", clear_seconds, frames, frames * count, frame_allocations});
+
+    // ****** Quadtree::search ******
+    {
+        std::vector<ptrdiff_t> results;
+        results.reserve(128);
+        size_t queries = 0;
+        size_t found = 0;
+        const size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+        const auto start = high_resolution_clock::now();
+        for (size_t i = 0; i < count; i += query_stride) {
+            Rectangle area {query_template};
+            area.center = points[i];
+            results.clear();
+            tree.search(area, results);
+            found += results.size();
+            ++queries;
+        }
+        const double seconds = delta(start);
+        const auto allocations = static_cast<double>(allocation_count.load(std::memory_order_relaxed) - allocations_before);
+        report(distribution, count, {"search", seconds, queries, found, allocations});
+    }
+
+    // ****** Boidtree search ******
+    {
+        BoidStore boids {count};
+        Boidtree boid_tree {bounds};
+        for (size_t i = 0; i < count; ++i) {
+            boids.set_position(i, points[i]);
+            boid_tree.insert(static_cast<uint32_t>(i), points[i]);
+        }
+
+        std::vector<Boid> results;
+        results.reserve(128);
+        size_t queries = 0;
+        size_t found = 0;
+        const size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+        const auto start = high_resolution_clock::now();
+        for (size_t i = 0; i < count; i += query_stride) {
+            Rectangle area {query_template};
+            area.center = boids.position(i);
+            results.clear();
+            search(boid_tree, boids, static_cast<uint32_t>(i), area, results);
+            found += results.size();
+            ++queries;
+        }
+        const double seconds = delta(start);
+        const auto allocations = static_cast<double>(allocation_count.load(std::memory_order_relaxed) - allocations_before);
+        report(distribution, count, {"boidtree search", seconds, queries, found, allocations});
+
+        // Same queries as circles of the same radius, keeping each neighbor's squared distance.
+        std::vector<uint32_t> indices;
+        std::vector<float> distances;
+        indices.reserve(128);
+        distances.reserve(128);
+        queries = 0;
+        found = 0;
+        const size_t radius_allocations_before = allocation_count.load(std::memory_order_relaxed);
+        const auto radius_start = high_resolution_clock::now();
+        for (size_t i = 0; i < count; i += query_stride) {
+            const Circle area {boids.position(i), Boid::cohesiveRadius};
+            indices.clear();
+            distances.clear();
+            search(boid_tree, boids, static_cast<uint32_t>(i), area, indices, &distances);
+            found += indices.size();
+            ++queries;
+        }
+        const double radius_seconds = delta(radius_start);
+        const auto radius_allocations = static_cast<double>(
+            allocation_count.load(std::memory_order_relaxed) - radius_allocations_before
+        );
+        report(distribution, count, {"boidtree radius", radius_seconds, queries, found, radius_allocations});
+    }
+}
+
+
+// Options:
+//   --min <count>   Smallest point count to run. Defaults to 1,000.
+//   --max <count>   Largest point count to run. Defaults to 10,000,000.
+//   --seed <seed>   Seed for the point distributions.
+int main(int argc, char *argv[]) {
+    size_t min_count = 1'000;
+    size_t max_count = 10'000'000;
+    uint32_t seed = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument {argv[i]};
+        const bool has_value = i + 1 < argc;
+        if (argument == "--min" && has_value) {
+            min_count = std::stoull(argv[++i]);
+            if (min_count < 1) {
+                std::cerr << "--min must be at least 1.\n";
+                return -1;
+            }
+        } else if (argument == "--max" && has_value) {
+            max_count = std::stoull(argv[++i]);
+        } else if (argument == "--seed" && has_value) {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else {
+            std::cerr << "Unknown argument: " << argument << '\n';
+            return -1;
+        }
+    }
+
+    std::cout << "Quadtree<T>: " << Quadtree<ptrdiff_t>::BucketItemCount << " items per bucket, max depth "
+              << Quadtree<ptrdiff_t>::MaxDepth << ".\n";
+    std::cout << "ns/op is per point for insert, per call for clear and per query for searches.\n"
+                 "points/s counts points inserted, cleared or returned.\n\n";
+    std::cout << std::left << std::setw(12) << "distribution"
+              << std::right << std::setw(10) << "points" << "  "
+              << std::left << std::setw(16) << "operation"
+              << std::right << std::setw(12) << "ns/op"
+              << std::setw(16) << "points/s"
+              << std::setw(14) << "allocs/frame"
+              << '\n';
+
+    for (size_t count = min_count; count <= max_count; count *= 10) {
+        for (const Distribution distribution: Distributions) {
+            run_distribution(distribution, count, seed);
+        }
+    }
+
+    return 0;
+}